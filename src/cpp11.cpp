@@ -6,10 +6,10 @@
 #include <R_ext/Visibility.h>
 
 // httpgd.cpp
-bool httpgd_(int devnum, std::string host, int port, bool cors, std::string token, bool silent, std::string wwwpath);
-extern "C" SEXP _httpgd_httpgd_(SEXP devnum, SEXP host, SEXP port, SEXP cors, SEXP token, SEXP silent, SEXP wwwpath) {
+bool httpgd_(int devnum, std::string host, int port, bool cors, std::string token, bool silent, std::string wwwpath, int io_threads, int render_threads, int debounce, int size_step, int compression, std::string socket, bool shared, int ws_queue_size);
+extern "C" SEXP _httpgd_httpgd_(SEXP devnum, SEXP host, SEXP port, SEXP cors, SEXP token, SEXP silent, SEXP wwwpath, SEXP io_threads, SEXP render_threads, SEXP debounce, SEXP size_step, SEXP compression, SEXP socket, SEXP shared, SEXP ws_queue_size) {
   BEGIN_CPP11
-    return cpp11::as_sexp(httpgd_(cpp11::as_cpp<cpp11::decay_t<int>>(devnum), cpp11::as_cpp<cpp11::decay_t<std::string>>(host), cpp11::as_cpp<cpp11::decay_t<int>>(port), cpp11::as_cpp<cpp11::decay_t<bool>>(cors), cpp11::as_cpp<cpp11::decay_t<std::string>>(token), cpp11::as_cpp<cpp11::decay_t<bool>>(silent), cpp11::as_cpp<cpp11::decay_t<std::string>>(wwwpath)));
+    return cpp11::as_sexp(httpgd_(cpp11::as_cpp<cpp11::decay_t<int>>(devnum), cpp11::as_cpp<cpp11::decay_t<std::string>>(host), cpp11::as_cpp<cpp11::decay_t<int>>(port), cpp11::as_cpp<cpp11::decay_t<bool>>(cors), cpp11::as_cpp<cpp11::decay_t<std::string>>(token), cpp11::as_cpp<cpp11::decay_t<bool>>(silent), cpp11::as_cpp<cpp11::decay_t<std::string>>(wwwpath), cpp11::as_cpp<cpp11::decay_t<int>>(io_threads), cpp11::as_cpp<cpp11::decay_t<int>>(render_threads), cpp11::as_cpp<cpp11::decay_t<int>>(debounce), cpp11::as_cpp<cpp11::decay_t<int>>(size_step), cpp11::as_cpp<cpp11::decay_t<int>>(compression), cpp11::as_cpp<cpp11::decay_t<std::string>>(socket), cpp11::as_cpp<cpp11::decay_t<bool>>(shared), cpp11::as_cpp<cpp11::decay_t<int>>(ws_queue_size)));
   END_CPP11
 }
 // httpgd.cpp
@@ -29,7 +29,7 @@ extern "C" SEXP _httpgd_httpgd_random_token_(SEXP len) {
 
 extern "C" {
 static const R_CallMethodDef CallEntries[] = {
-    {"_httpgd_httpgd_",              (DL_FUNC) &_httpgd_httpgd_,              7},
+    {"_httpgd_httpgd_",              (DL_FUNC) &_httpgd_httpgd_,             15},
     {"_httpgd_httpgd_details_",      (DL_FUNC) &_httpgd_httpgd_details_,      1},
     {"_httpgd_httpgd_random_token_", (DL_FUNC) &_httpgd_httpgd_random_token_, 1},
     {NULL, NULL, 0}
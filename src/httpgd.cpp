@@ -10,28 +10,78 @@
 
 // #include <R_ext/GraphicsEngine.h>
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
+#include "httpgd_cpu.h"
 #include "httpgd_rng.h"
 #include "httpgd_version.h"
 #include "httpgd_webserver.h"
 #include "unigd_impl.h"
 
 [[cpp11::register]] bool httpgd_(int devnum, std::string host, int port, bool cors,
-                                 std::string token, bool silent, std::string wwwpath)
+                                 std::string token, bool silent, std::string wwwpath,
+                                 int io_threads, int render_threads, int debounce,
+                                 int size_step, int compression, std::string socket,
+                                 bool shared, int ws_queue_size)
 {
   // wwwpath must be determined in R, because devtools overrides system.path
   // with a shim which results in an empty string *sometimes*.
 
   bool recording = true;
   bool use_token = token.length();
+  const std::size_t render_cache_size = 64 * 1024 * 1024;
+  const unsigned debounce_ms = debounce < 0 ? 0 : static_cast<unsigned>(debounce);
+  const std::size_t ws_queue_size_bytes =
+      ws_queue_size < 0 ? 0 : static_cast<std::size_t>(ws_queue_size);
+  const unsigned size_step_px = size_step < 0 ? 0 : static_cast<unsigned>(size_step);
+  const int compression_level = compression < 0 ? 0 : std::min(compression, 9);
+  const std::size_t compression_min_size = 1024;
 
-  const httpgd::web::HttpgdServerConfig conf{host,      port,      wwwpath,
-                                             cors,      use_token, token,
-                                             recording, silent,    httpgd::rng::uuid()};
+#ifndef CROW_HAS_UNIX_SOCKET
+  if (!socket.empty())
+  {
+    cpp11::stop("Unix domain sockets are not supported on this platform.");
+  }
+#endif
+
+  const httpgd::web::HttpgdServerConfig conf{host,
+                                             port,
+                                             socket,
+                                             shared,
+                                             wwwpath,
+                                             cors,
+                                             use_token,
+                                             token,
+                                             recording,
+                                             silent,
+                                             httpgd::rng::uuid(),
+                                             render_cache_size,
+                                             httpgd::cpu::io_threads(io_threads),
+                                             httpgd::cpu::render_threads(render_threads),
+                                             debounce_ms,
+                                             ws_queue_size_bytes,
+                                             size_step_px,
+                                             compression_level,
+                                             compression_min_size};
 
-  return (new httpgd::web::WebServer(conf))->attach(devnum);
+  httpgd::web::WebServer* server;
+  try
+  {
+    server = new httpgd::web::WebServer(conf);
+  }
+  catch (const std::exception&)
+  {
+    // The shared server could not be started.
+    return false;
+  }
+  if (!server->attach(devnum))
+  {
+    delete server;
+    return false;
+  }
+  return true;
 }
 
 [[cpp11::register]] cpp11::list httpgd_details_(int devnum)
@@ -52,7 +102,9 @@
   using namespace cpp11::literals;
   return cpp11::writable::list{
       "host"_nm = svr_config.host.c_str(), "port"_nm = server->port(),
-      "token"_nm = svr_config.token.c_str(), "status"_nm = server->status_info()};
+      "socket"_nm = svr_config.socket_path.c_str(), "path"_nm = server->path().c_str(),
+      "token"_nm = svr_config.token.c_str(),
+      "status"_nm = server->status_info()};
   return cpp11::writable::list{};
 }
 
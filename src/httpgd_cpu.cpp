@@ -0,0 +1,138 @@
+#include "httpgd_cpu.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace httpgd
+{
+namespace cpu
+{
+namespace
+{
+#ifdef __linux__
+// Returns the CPU limit of a cgroup v2 "cpu.max" file ("<quota> <period>" or
+// "max <period>"), or 0 if there is none.
+double cgroup2_limit(const std::string& t_path)
+{
+  std::ifstream f(t_path);
+  std::string quota;
+  double period = 0;
+  if (!(f >> quota >> period) || quota == "max" || period <= 0)
+  {
+    return 0;
+  }
+  try
+  {
+    return std::stod(quota) / period;
+  }
+  catch (const std::exception&)
+  {
+    return 0;
+  }
+}
+
+double cgroup1_limit(const std::string& t_dir)
+{
+  std::ifstream fq(t_dir + "/cpu.cfs_quota_us");
+  std::ifstream fp(t_dir + "/cpu.cfs_period_us");
+  double quota = 0;
+  double period = 0;
+  if (!(fq >> quota) || !(fp >> period) || quota <= 0 || period <= 0)
+  {
+    return 0;
+  }
+  return quota / period;
+}
+
+// Path of this process' cgroup v2 group relative to the cgroup mount.
+std::string cgroup2_path()
+{
+  std::ifstream f("/proc/self/cgroup");
+  std::string line;
+  while (std::getline(f, line))
+  {
+    if (line.compare(0, 3, "0::") == 0)
+    {
+      return line.substr(3);
+    }
+  }
+  return "";
+}
+
+double cgroup_limit()
+{
+  const auto own = cgroup2_path();
+  if (!own.empty() && own != "/")
+  {
+    const auto limit = cgroup2_limit("/sys/fs/cgroup" + own + "/cpu.max");
+    if (limit > 0)
+    {
+      return limit;
+    }
+  }
+  const auto limit = cgroup2_limit("/sys/fs/cgroup/cpu.max");
+  if (limit > 0)
+  {
+    return limit;
+  }
+  const auto limit_v1 = cgroup1_limit("/sys/fs/cgroup/cpu");
+  if (limit_v1 > 0)
+  {
+    return limit_v1;
+  }
+  return cgroup1_limit("/sys/fs/cgroup/cpu,cpuacct");
+}
+#endif
+}  // namespace
+
+unsigned available()
+{
+  unsigned cpus = std::thread::hardware_concurrency();
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0)
+  {
+    cpus = static_cast<unsigned>(CPU_COUNT(&set));
+  }
+  const auto limit = cgroup_limit();
+  if (limit > 0)
+  {
+    cpus = std::min(cpus, static_cast<unsigned>(std::ceil(limit)));
+  }
+#endif
+  return std::max(cpus, 1U);
+}
+
+unsigned io_threads(int t_setting)
+{
+  if (t_setting > 0)
+  {
+    // Crow counts its threads in 16 bits.
+    return std::min(std::max(static_cast<unsigned>(t_setting), 2U),
+                    static_cast<unsigned>(std::numeric_limits<std::uint16_t>::max()));
+  }
+  // Crow needs an acceptor and at least one worker thread. Add a worker per 4 CPUs.
+  return std::min(2U + available() / 4, 4U);
+}
+
+unsigned render_threads(int t_setting)
+{
+  if (t_setting > 0)
+  {
+    return static_cast<unsigned>(t_setting);
+  }
+  // Leave one CPU to R itself.
+  return std::max(1U, std::min(available() - 1, 4U));
+}
+}  // namespace cpu
+}  // namespace httpgd
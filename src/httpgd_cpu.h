@@ -0,0 +1,26 @@
+#ifndef __UNIGD_HTTPGD_CPU_H__
+#define __UNIGD_HTTPGD_CPU_H__
+
+namespace httpgd
+{
+namespace cpu
+{
+/**
+ * @brief Number of CPUs this process may actually use.
+ *
+ * Respects cgroup CPU quotas (v1 and v2) and the scheduler affinity mask on
+ * Linux, which `std::thread::hardware_concurrency()` ignores. Always returns
+ * at least 1.
+ */
+unsigned available();
+
+/**
+ * @brief Resolve a thread count setting. Values of 0 select a count derived
+ * from `available()`. IO thread counts are limited to 2 to 65535.
+ */
+unsigned io_threads(int t_setting);
+unsigned render_threads(int t_setting);
+}  // namespace cpu
+}  // namespace httpgd
+
+#endif /* __UNIGD_HTTPGD_CPU_H__ */
@@ -0,0 +1,243 @@
+#include "httpgd_render_cache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+namespace httpgd
+{
+namespace web
+{
+namespace
+{
+inline void hash_combine(std::size_t& t_seed, std::size_t t_value)
+{
+  t_seed ^= t_value + 0x9e3779b9 + (t_seed << 6) + (t_seed >> 2);
+}
+}  // namespace
+
+bool RenderKey::operator==(const RenderKey& t_other) const
+{
+  return id == t_other.id && upid == t_other.upid && width == t_other.width &&
+         height == t_other.height && zoom == t_other.zoom &&
+         renderer == t_other.renderer;
+}
+
+std::size_t RenderKeyHash::operator()(const RenderKey& t_key) const
+{
+  std::size_t seed = std::hash<UNIGD_PLOT_ID>()(t_key.id);
+  hash_combine(seed, std::hash<int>()(t_key.upid));
+  hash_combine(seed, std::hash<std::string>()(t_key.renderer));
+  hash_combine(seed, std::hash<double>()(t_key.width));
+  hash_combine(seed, std::hash<double>()(t_key.height));
+  hash_combine(seed, std::hash<double>()(t_key.zoom));
+  return seed;
+}
+
+RenderResult::RenderResult(unigd_api_v1* t_api, UNIGD_RENDER_HANDLE t_handle,
+                           const unigd_render_access& t_access)
+    : m_api(t_api), m_handle(t_handle), m_access(t_access)
+{
+}
+
+RenderResult::~RenderResult()
+{
+  if (m_api && m_handle)
+  {
+    m_api->device_render_destroy(m_handle);
+  }
+}
+
+std::shared_ptr<const std::string> RenderResult::encoded(const std::string& t_coding,
+                                                        const encode_fn& t_encode) const
+{
+  // Held while encoding: concurrent requests for a new coding wait for the first
+  // one instead of compressing the same buffer again.
+  std::lock_guard<std::mutex> lock(m_mtx_encoded);
+  for (const auto& encoding : m_encoded)
+  {
+    if (encoding.first == t_coding)
+    {
+      return encoding.second;
+    }
+  }
+  auto encoding = t_encode(m_access.buffer, size());
+  if (encoding.empty())
+  {
+    return nullptr;
+  }
+  auto result = std::make_shared<const std::string>(std::move(encoding));
+  m_encoded.emplace_back(t_coding, result);
+  return result;
+}
+
+RenderCache::RenderCache(std::size_t t_max_bytes) : m_max_bytes(t_max_bytes) {}
+
+std::shared_ptr<const RenderResult> RenderCache::get(const RenderKey& t_key)
+{
+  std::lock_guard<std::mutex> lock(m_mtx);
+  const auto it = m_index.find(t_key);
+  if (it == m_index.end())
+  {
+    ++m_misses;
+    return nullptr;
+  }
+  ++m_hits;
+  m_lru.splice(m_lru.begin(), m_lru, it->second);
+  return it->second->second;
+}
+
+void RenderCache::put(const RenderKey& t_key,
+                      std::shared_ptr<const RenderResult> t_render)
+{
+  std::lock_guard<std::mutex> lock(m_mtx);
+  insert(t_key, std::move(t_render));
+}
+
+std::shared_ptr<const RenderResult> RenderCache::get_or_render(const RenderKey& t_key,
+                                                               const render_fn& t_render)
+{
+  std::promise<std::shared_ptr<const RenderResult>> promise;
+  {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    const auto it = m_index.find(t_key);
+    if (it != m_index.end())
+    {
+      ++m_hits;
+      m_lru.splice(m_lru.begin(), m_lru, it->second);
+      return it->second->second;
+    }
+    const auto flight = m_in_flight.find(t_key);
+    if (flight != m_in_flight.end())
+    {
+      ++m_shared;
+      auto result = flight->second;
+      lock.unlock();
+      return result.get();
+    }
+    ++m_misses;
+    m_in_flight.emplace(t_key, promise.get_future().share());
+  }
+
+  std::shared_ptr<const RenderResult> render;
+  try
+  {
+    render = t_render();
+  }
+  catch (...)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mtx);
+      m_in_flight.erase(t_key);
+    }
+    promise.set_exception(std::current_exception());
+    throw;
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    insert(t_key, render);
+    m_in_flight.erase(t_key);
+  }
+  promise.set_value(render);
+  return render;
+}
+
+void RenderCache::insert(const RenderKey& t_key,
+                         std::shared_ptr<const RenderResult> t_render)
+{
+  if (!t_render || t_render->size() > m_max_bytes || t_key.upid < m_upid)
+  {
+    return;
+  }
+  const auto it = m_index.find(t_key);
+  if (it != m_index.end())
+  {
+    erase(it->second);
+  }
+  m_bytes += t_render->size();
+  m_lru.emplace_front(t_key, std::move(t_render));
+  m_index.emplace(t_key, m_lru.begin());
+  evict();
+}
+
+RenderCache::entry RenderCache::nearest(const RenderKey& t_key, double t_max_delta)
+{
+  std::lock_guard<std::mutex> lock(m_mtx);
+  auto best = m_lru.end();
+  double best_delta = 0;
+  for (auto it = m_lru.begin(); it != m_lru.end(); ++it)
+  {
+    const auto& key = it->first;
+    if (key.id != t_key.id || key.upid != t_key.upid || key.zoom != t_key.zoom ||
+        key.renderer != t_key.renderer)
+    {
+      continue;
+    }
+    const auto dw = std::abs(key.width - t_key.width);
+    const auto dh = std::abs(key.height - t_key.height);
+    if (dw <= t_max_delta && dh <= t_max_delta &&
+        (best == m_lru.end() || dw + dh < best_delta))
+    {
+      best = it;
+      best_delta = dw + dh;
+    }
+  }
+  if (best == m_lru.end())
+  {
+    return {t_key, nullptr};
+  }
+  if (!(best->first == t_key))
+  {
+    ++m_nearest;
+  }
+  m_lru.splice(m_lru.begin(), m_lru, best);
+  return *best;
+}
+
+void RenderCache::invalidate(int t_upid)
+{
+  std::lock_guard<std::mutex> lock(m_mtx);
+  m_upid = std::max(m_upid, t_upid);
+  for (auto it = m_lru.begin(); it != m_lru.end();)
+  {
+    auto next = std::next(it);
+    if (it->first.upid != t_upid)
+    {
+      erase(it);
+    }
+    it = next;
+  }
+}
+
+void RenderCache::clear()
+{
+  std::lock_guard<std::mutex> lock(m_mtx);
+  m_index.clear();
+  m_lru.clear();
+  m_bytes = 0;
+}
+
+RenderCache::Stats RenderCache::stats() const
+{
+  std::lock_guard<std::mutex> lock(m_mtx);
+  return {m_hits, m_misses, m_shared, m_nearest, m_evictions, m_lru.size(), m_bytes};
+}
+
+void RenderCache::erase(std::list<entry>::iterator t_it)
+{
+  m_bytes -= t_it->second->size();
+  m_index.erase(t_it->first);
+  m_lru.erase(t_it);
+}
+
+void RenderCache::evict()
+{
+  while (m_bytes > m_max_bytes && !m_lru.empty())
+  {
+    erase(std::prev(m_lru.end()));
+    ++m_evictions;
+  }
+}
+
+}  // namespace web
+}  // namespace httpgd
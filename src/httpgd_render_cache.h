@@ -0,0 +1,165 @@
+#ifndef __UNIGD_HTTPGD_RENDER_CACHE_H__
+#define __UNIGD_HTTPGD_RENDER_CACHE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "unigd_impl.h"
+
+namespace httpgd
+{
+namespace web
+{
+/**
+ * @brief Identifies a rendered plot. Two renders with equal keys are
+ * byte-identical.
+ */
+struct RenderKey
+{
+  UNIGD_PLOT_ID id;
+  int upid;
+  std::string renderer;
+  double width;
+  double height;
+  double zoom;
+
+  bool operator==(const RenderKey& t_other) const;
+};
+
+struct RenderKeyHash
+{
+  std::size_t operator()(const RenderKey& t_key) const;
+};
+
+/**
+ * @brief Owns a unigd render handle and keeps its buffer alive until the
+ * last reference is dropped.
+ *
+ * Compressed encodings of the buffer are created on demand and kept with it,
+ * so a cached render is compressed at most once per content coding. They are
+ * not counted in the cache size.
+ */
+class RenderResult
+{
+ public:
+  RenderResult(unigd_api_v1* t_api, UNIGD_RENDER_HANDLE t_handle,
+               const unigd_render_access& t_access);
+  ~RenderResult();
+
+  RenderResult(const RenderResult&) = delete;
+  RenderResult& operator=(const RenderResult&) = delete;
+
+  const uint8_t* data() const { return m_access.buffer; }
+
+  std::size_t size() const { return static_cast<std::size_t>(m_access.size); }
+
+  using encode_fn = std::function<std::string(const uint8_t*, std::size_t)>;
+
+  /**
+   * @brief Get the buffer encoded with content coding `t_coding` (e.g. "gzip").
+   *
+   * The first call for a coding creates it with `t_encode`, later calls return
+   * the stored encoding. Returns null if encoding failed.
+   */
+  std::shared_ptr<const std::string> encoded(const std::string& t_coding,
+                                             const encode_fn& t_encode) const;
+
+ private:
+  unigd_api_v1* m_api;
+  UNIGD_RENDER_HANDLE m_handle;
+  unigd_render_access m_access;
+
+  mutable std::mutex m_mtx_encoded;
+  mutable std::vector<std::pair<std::string, std::shared_ptr<const std::string>>>
+      m_encoded;
+};
+
+/**
+ * @brief Byte-bounded LRU cache of render results.
+ *
+ * All methods are thread safe.
+ */
+class RenderCache
+{
+ public:
+  struct Stats
+  {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t shared;
+    uint64_t nearest;
+    uint64_t evictions;
+    std::size_t entries;
+    std::size_t bytes;
+  };
+
+  explicit RenderCache(std::size_t t_max_bytes);
+
+  using entry = std::pair<RenderKey, std::shared_ptr<const RenderResult>>;
+  using render_fn = std::function<std::shared_ptr<const RenderResult>()>;
+
+  std::shared_ptr<const RenderResult> get(const RenderKey& t_key);
+  void put(const RenderKey& t_key, std::shared_ptr<const RenderResult> t_render);
+
+  /**
+   * @brief Get a cached render or create it with `t_render`.
+   *
+   * Concurrent calls with the same key render only once: later callers wait
+   * for the first one and share its result (or exception).
+   */
+  std::shared_ptr<const RenderResult> get_or_render(const RenderKey& t_key,
+                                                    const render_fn& t_render);
+
+  /**
+   * @brief Find the cached render of the same plot, update ID, renderer and
+   * zoom level whose size is closest to `t_key`.
+   *
+   * Width and height may each differ by at most `t_max_delta`. Returns an
+   * entry with a null render if there is none.
+   */
+  entry nearest(const RenderKey& t_key, double t_max_delta);
+
+  /**
+   * @brief Drop all entries that were not rendered at update ID `t_upid`.
+   * Renders of older update IDs that finish later are not cached.
+   */
+  void invalidate(int t_upid);
+  void clear();
+
+  Stats stats() const;
+
+ private:
+  std::size_t m_max_bytes;
+  std::size_t m_bytes = 0;
+  uint64_t m_hits = 0;
+  uint64_t m_misses = 0;
+  uint64_t m_shared = 0;
+  uint64_t m_nearest = 0;
+  uint64_t m_evictions = 0;
+  // Update ID of the last invalidation, older renders are outdated.
+  int m_upid = 0;
+
+  mutable std::mutex m_mtx;
+  std::list<entry> m_lru;
+  std::unordered_map<RenderKey, std::list<entry>::iterator, RenderKeyHash> m_index;
+  std::unordered_map<RenderKey, std::shared_future<std::shared_ptr<const RenderResult>>,
+                     RenderKeyHash>
+      m_in_flight;
+
+  void insert(const RenderKey& t_key, std::shared_ptr<const RenderResult> t_render);
+  void erase(std::list<entry>::iterator t_it);
+  void evict();
+};
+}  // namespace web
+}  // namespace httpgd
+
+#endif /* __UNIGD_HTTPGD_RENDER_CACHE_H__ */
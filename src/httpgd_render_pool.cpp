@@ -0,0 +1,108 @@
+#include "httpgd_render_pool.h"
+
+#include <algorithm>
+#include <initializer_list>
+
+namespace httpgd
+{
+namespace web
+{
+RenderPool::RenderPool(std::size_t t_threads)
+{
+  t_threads = std::max<std::size_t>(t_threads, 1);
+  m_threads.reserve(t_threads);
+  for (std::size_t i = 0; i < t_threads; ++i)
+  {
+    m_threads.emplace_back(&RenderPool::work, this);
+  }
+}
+
+RenderPool::~RenderPool()
+{
+  stop();
+}
+
+bool RenderPool::submit(task t_task, Priority t_priority, task t_cancel)
+{
+  {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    if (m_stopping)
+    {
+      lock.unlock();
+      if (t_cancel)
+      {
+        t_cancel();
+      }
+      return false;
+    }
+    auto& queue = t_priority == Priority::interactive ? m_queue : m_background;
+    queue.push_back({std::move(t_task), std::move(t_cancel)});
+  }
+  m_cv.notify_one();
+  return true;
+}
+
+void RenderPool::stop()
+{
+  std::deque<Job> discarded;
+  std::deque<Job> discarded_background;
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_stopping = true;
+    discarded.swap(m_queue);
+    discarded_background.swap(m_background);
+  }
+  m_cv.notify_all();
+  for (auto* jobs : {&discarded, &discarded_background})
+  {
+    for (auto& job : *jobs)
+    {
+      if (job.cancel)
+      {
+        job.cancel();
+      }
+    }
+  }
+  for (auto& t : m_threads)
+  {
+    if (t.joinable())
+    {
+      t.join();
+    }
+  }
+}
+
+std::size_t RenderPool::size() const
+{
+  return m_threads.size();
+}
+
+std::size_t RenderPool::pending() const
+{
+  std::lock_guard<std::mutex> lock(m_mtx);
+  return m_queue.size() + m_background.size();
+}
+
+void RenderPool::work()
+{
+  while (true)
+  {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(m_mtx);
+      m_cv.wait(lock, [this]
+                { return m_stopping || !m_queue.empty() || !m_background.empty(); });
+      if (m_stopping)
+      {
+        return;
+      }
+      auto& queue = m_queue.empty() ? m_background : m_queue;
+      job = std::move(queue.front());
+      queue.pop_front();
+    }
+    job.run();
+  }
+}
+
+}  // namespace web
+}  // namespace httpgd
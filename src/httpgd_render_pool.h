@@ -0,0 +1,74 @@
+#ifndef __UNIGD_HTTPGD_RENDER_POOL_H__
+#define __UNIGD_HTTPGD_RENDER_POOL_H__
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace httpgd
+{
+namespace web
+{
+/**
+ * @brief Fixed size thread pool that runs plot renders off the IO threads.
+ *
+ * Background tasks only run when no interactive task is queued.
+ */
+class RenderPool
+{
+ public:
+  using task = std::function<void()>;
+
+  enum class Priority
+  {
+    interactive,
+    background
+  };
+
+  explicit RenderPool(std::size_t t_threads);
+  ~RenderPool();
+
+  RenderPool(const RenderPool&) = delete;
+  RenderPool& operator=(const RenderPool&) = delete;
+
+  /**
+   * @brief Queue a task. If the task never runs because the pool is stopped,
+   * `t_cancel` (if set) is called instead, e.g. to answer a waiting request.
+   *
+   * @return false if the pool is already stopped. `t_cancel` has run then.
+   */
+  bool submit(task t_task, Priority t_priority = Priority::interactive,
+              task t_cancel = nullptr);
+
+  /**
+   * @brief Cancel queued tasks, wait for running tasks and join all threads.
+   */
+  void stop();
+
+  std::size_t size() const;
+  std::size_t pending() const;
+
+ private:
+  struct Job
+  {
+    task run;
+    task cancel;
+  };
+
+  mutable std::mutex m_mtx;
+  std::condition_variable m_cv;
+  std::deque<Job> m_queue;
+  std::deque<Job> m_background;
+  bool m_stopping = false;
+  std::vector<std::thread> m_threads;
+
+  void work();
+};
+}  // namespace web
+}  // namespace httpgd
+
+#endif /* __UNIGD_HTTPGD_RENDER_POOL_H__ */
@@ -0,0 +1,190 @@
+#include "httpgd_shared_server.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <stdexcept>
+#include <utility>
+
+namespace httpgd
+{
+namespace web
+{
+namespace
+{
+std::mutex shared_mtx;
+std::weak_ptr<SharedServer> shared_instance;
+
+// Device IDs are unique for the lifetime of the process, so clients of a
+// closed device never reach a later one.
+std::atomic<uint64_t> next_device_id{1};
+
+// WebSocket connections carry the ID of their device as user data.
+inline uint64_t connection_device(crow::websocket::connection& conn)
+{
+  return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(conn.userdata()));
+}
+}  // namespace
+
+SharedServer::SharedServer(const HttpgdServerConfig& t_conf)
+    : m_conf(t_conf)
+    , m_app()
+    , m_render_pool(std::make_shared<RenderPool>(t_conf.render_threads))
+    , m_static_assets(std::make_shared<StaticAssets>())
+{
+  // The web client is served from memory, gzip encodings are made once here.
+  m_static_assets->load(m_conf.wwwpath, m_conf.compression_level > 0 ? 9 : 0);
+  m_server_thread = std::thread(&SharedServer::run, this);
+}
+
+SharedServer::~SharedServer()
+{
+  m_app.stop();
+  if (m_server_thread.joinable())
+  {
+    m_server_thread.join();
+  }
+  m_render_pool->stop();
+}
+
+std::shared_ptr<SharedServer> SharedServer::acquire(const HttpgdServerConfig& t_conf)
+{
+  std::lock_guard<std::mutex> _(shared_mtx);
+  auto server = shared_instance.lock();
+  if (server)
+  {
+    return server;
+  }
+  server = std::make_shared<SharedServer>(t_conf);
+  if (server->m_app.wait_for_server_start() == std::cv_status::timeout)
+  {
+    // E.g. the port is in use or the socket path is not writable.
+    throw std::runtime_error("Failed to start shared server.");
+  }
+  shared_instance = server;
+  return server;
+}
+
+uint64_t SharedServer::add(WebServer* t_device)
+{
+  const auto id = next_device_id++;
+  std::lock_guard<std::mutex> _(m_mtx_devices);
+  m_devices.emplace(id, t_device);
+  return id;
+}
+
+void SharedServer::remove(uint64_t t_id)
+{
+  std::lock_guard<std::mutex> _(m_mtx_devices);
+  m_devices.erase(t_id);
+}
+
+SharedServer::DeviceUse SharedServer::find(uint64_t t_id)
+{
+  std::lock_guard<std::mutex> _(m_mtx_devices);
+  const auto it = m_devices.find(t_id);
+  if (it == m_devices.end())
+  {
+    return nullptr;
+  }
+  it->second->retain();
+  return DeviceUse(it->second);
+}
+
+const HttpgdServerConfig& SharedServer::get_config() const
+{
+  return m_conf;
+}
+
+unsigned short SharedServer::port()
+{
+  m_app.wait_for_server_start();
+  return m_app.port();
+}
+
+std::shared_ptr<RenderPool> SharedServer::render_pool()
+{
+  return m_render_pool;
+}
+
+std::shared_ptr<StaticAssets> SharedServer::static_assets()
+{
+  return m_static_assets;
+}
+
+void SharedServer::run()
+{
+  // Tokens are checked per device, see WebServer::handle().
+  CROW_ROUTE(m_app, "/dev/<uint>/<string>")
+  (
+      [this](const crow::request& req, crow::response& res, uint64_t id,
+             std::string name)
+      {
+        const auto device = find(id);
+        if (!device)
+        {
+          res.code = crow::status::NOT_FOUND;
+          res.end();
+          return;
+        }
+        device->handle(name, req, res);
+      });
+
+  CROW_WEBSOCKET_ROUTE(m_app, "/dev/<uint>")
+      .subprotocols({PUSH_PROTOCOL})
+      .onaccept(
+          [this](const crow::request& req, void** userdata)
+          {
+            const auto id = std::strtoull(req.url.c_str() + 5, nullptr, 10);
+            if (!find(id))
+            {
+              return false;
+            }
+            *userdata = reinterpret_cast<void*>(static_cast<uintptr_t>(id));
+            return true;
+          })
+      .onopen(
+          [this](crow::websocket::connection& conn)
+          {
+            const auto device = find(connection_device(conn));
+            if (!device)
+            {
+              conn.close("device closed");
+              return;
+            }
+            device->ws_open(conn);
+          })
+      .onclose(
+          [this](crow::websocket::connection& conn, const std::string& reason,
+                 uint16_t code)
+          {
+            CROW_LOG_INFO << "websocket connection closed: " << reason;
+            const auto device = find(connection_device(conn));
+            if (device)
+            {
+              device->ws_close(conn, code);
+            }
+          })
+      .onmessage(
+          [this](crow::websocket::connection& conn, const std::string& data,
+                 bool is_binary)
+          {
+            const auto device = find(connection_device(conn));
+            if (device)
+            {
+              device->ws_message(conn, data, is_binary);
+            }
+          });
+
+  configure_app(m_app, m_conf);
+  try
+  {
+    m_app.run();
+  }
+  catch (const std::exception& e)
+  {
+    CROW_LOG_ERROR << "Shared server failed: " << e.what();
+  }
+}
+
+}  // namespace web
+}  // namespace httpgd
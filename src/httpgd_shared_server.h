@@ -0,0 +1,81 @@
+#ifndef __UNIGD_HTTPGD_SHARED_SERVER_H__
+#define __UNIGD_HTTPGD_SHARED_SERVER_H__
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <crow.h>
+#include <crow/middlewares/cors.h>
+
+#include "httpgd_render_pool.h"
+#include "httpgd_static_assets.h"
+#include "httpgd_webserver.h"
+
+namespace httpgd
+{
+namespace web
+{
+/**
+ * @brief Process-wide server of all devices started with `shared = TRUE`.
+ *
+ * Devices are served under `/dev/<id>/` on one port, with one set of IO
+ * threads, one render pool and one copy of the web client. The server is
+ * started by the first device with the settings of that device and stops
+ * when the last device is closed.
+ */
+class SharedServer
+{
+ public:
+  explicit SharedServer(const HttpgdServerConfig& t_conf);
+  ~SharedServer();
+
+  SharedServer(const SharedServer&) = delete;
+  SharedServer& operator=(const SharedServer&) = delete;
+
+  /**
+   * @brief Get the running shared server, or start one with `t_conf`.
+   */
+  static std::shared_ptr<SharedServer> acquire(const HttpgdServerConfig& t_conf);
+
+  /**
+   * @brief Serve a device. Returns its ID, which is never reused.
+   */
+  uint64_t add(WebServer* t_device);
+
+  /**
+   * @brief Stop routing requests to a device. Requests already dispatched to it
+   * still hold a use of the device (see `WebServer::retain()`).
+   */
+  void remove(uint64_t t_id);
+
+  const HttpgdServerConfig& get_config() const;
+  unsigned short port();
+  std::shared_ptr<RenderPool> render_pool();
+  std::shared_ptr<StaticAssets> static_assets();
+
+ private:
+  struct Release
+  {
+    void operator()(WebServer* t_device) const { t_device->release(); }
+  };
+  using DeviceUse = std::unique_ptr<WebServer, Release>;
+
+  HttpgdServerConfig m_conf;
+  crow::App<crow::CORSHandler> m_app;
+  std::shared_ptr<RenderPool> m_render_pool;
+  std::shared_ptr<StaticAssets> m_static_assets;
+  std::mutex m_mtx_devices;
+  std::unordered_map<uint64_t, WebServer*> m_devices;
+  std::thread m_server_thread;
+
+  DeviceUse find(uint64_t t_id);
+  void run();
+};
+}  // namespace web
+}  // namespace httpgd
+
+#endif /* __UNIGD_HTTPGD_SHARED_SERVER_H__ */
@@ -0,0 +1,85 @@
+#include "httpgd_state_debouncer.h"
+
+namespace httpgd
+{
+namespace web
+{
+StateDebouncer::StateDebouncer(std::chrono::milliseconds t_interval,
+                               callback t_callback)
+    : m_interval(t_interval)
+    , m_callback(std::move(t_callback))
+    , m_last_sent(clock::now() - t_interval)
+    , m_thread(&StateDebouncer::work, this)
+{
+}
+
+StateDebouncer::~StateDebouncer()
+{
+  stop();
+}
+
+void StateDebouncer::notify()
+{
+  if (m_dirty.exchange(true, std::memory_order_acq_rel))
+  {
+    m_coalesced.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  // Taking the lock (never held during the callback) orders the wake-up
+  // with the debouncer thread's predicate check.
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+  }
+  m_cv.notify_one();
+}
+
+void StateDebouncer::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_stopping = true;
+  }
+  m_cv.notify_all();
+  if (m_thread.joinable())
+  {
+    m_thread.join();
+  }
+}
+
+StateDebouncer::Stats StateDebouncer::stats() const
+{
+  return {m_sent.load(std::memory_order_relaxed),
+          m_coalesced.load(std::memory_order_relaxed)};
+}
+
+void StateDebouncer::work()
+{
+  std::unique_lock<std::mutex> lock(m_mtx);
+  while (true)
+  {
+    m_cv.wait(lock, [this] { return m_stopping || m_dirty.load(); });
+    if (m_stopping)
+    {
+      return;
+    }
+
+    // Trailing edge: wait out the rest of the interval, further
+    // notifications are coalesced meanwhile.
+    const auto due = m_last_sent + m_interval;
+    if (m_cv.wait_until(lock, due, [this] { return m_stopping; }))
+    {
+      return;
+    }
+
+    m_dirty.store(false, std::memory_order_release);
+    m_last_sent = clock::now();
+    m_sent.fetch_add(1, std::memory_order_relaxed);
+
+    lock.unlock();
+    m_callback();
+    lock.lock();
+  }
+}
+
+}  // namespace web
+}  // namespace httpgd
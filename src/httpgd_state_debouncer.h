@@ -0,0 +1,77 @@
+#ifndef __UNIGD_HTTPGD_STATE_DEBOUNCER_H__
+#define __UNIGD_HTTPGD_STATE_DEBOUNCER_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace httpgd
+{
+namespace web
+{
+/**
+ * @brief Coalesces device state change notifications and handles them on its
+ * own thread.
+ *
+ * Notifying only sets a flag, the callback (which fetches and broadcasts the
+ * current state) runs on the debouncer thread. A notification after an idle
+ * period is handled immediately, notifications in quick succession are handled
+ * at most once per interval.
+ */
+class StateDebouncer
+{
+ public:
+  using callback = std::function<void()>;
+
+  struct Stats
+  {
+    uint64_t sent;
+    uint64_t coalesced;
+  };
+
+  StateDebouncer(std::chrono::milliseconds t_interval, callback t_callback);
+  ~StateDebouncer();
+
+  StateDebouncer(const StateDebouncer&) = delete;
+  StateDebouncer& operator=(const StateDebouncer&) = delete;
+
+  /**
+   * @brief Mark the state as changed. Constant cost: a notification that finds
+   * the state already marked is a single atomic operation, otherwise the
+   * debouncer thread is woken once.
+   */
+  void notify();
+
+  /**
+   * @brief Drop pending notifications and join the debouncer thread.
+   */
+  void stop();
+
+  Stats stats() const;
+
+ private:
+  using clock = std::chrono::steady_clock;
+
+  std::chrono::milliseconds m_interval;
+  callback m_callback;
+
+  std::atomic<bool> m_dirty{false};
+  std::atomic<uint64_t> m_sent{0};
+  std::atomic<uint64_t> m_coalesced{0};
+
+  std::mutex m_mtx;
+  std::condition_variable m_cv;
+  clock::time_point m_last_sent;
+  bool m_stopping = false;
+  std::thread m_thread;
+
+  void work();
+};
+}  // namespace web
+}  // namespace httpgd
+
+#endif /* __UNIGD_HTTPGD_STATE_DEBOUNCER_H__ */
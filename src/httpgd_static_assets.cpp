@@ -0,0 +1,159 @@
+#include "httpgd_static_assets.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+#include <crow/compression.h>
+#include <crow/mime_types.h>
+#include <fmt/format.h>
+
+namespace httpgd
+{
+namespace web
+{
+namespace
+{
+// 64-bit FNV-1a, only used to tell asset versions apart.
+inline uint64_t content_hash(const std::string& t_data)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const unsigned char c : t_data)
+  {
+    hash = (hash ^ c) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+inline std::string content_version(const std::string& t_data)
+{
+  return fmt::format("{:016x}", content_hash(t_data));
+}
+
+inline bool is_text(const std::string& t_mime)
+{
+  return t_mime.compare(0, 5, "text/") == 0 || t_mime == "application/javascript" ||
+         t_mime == "application/json" || t_mime == "image/svg+xml";
+}
+
+inline bool read_file(const std::string& t_path, std::string& t_content)
+{
+  struct stat statbuf;
+  if (stat(t_path.c_str(), &statbuf) != 0 || !S_ISREG(statbuf.st_mode))
+  {
+    return false;
+  }
+  std::ifstream file(t_path, std::ios::binary);
+  if (!file)
+  {
+    return false;
+  }
+  std::ostringstream content;
+  content << file.rdbuf();
+  t_content = content.str();
+  return true;
+}
+
+inline void replace_all(std::string& t_str, const std::string& t_from,
+                        const std::string& t_to)
+{
+  for (auto pos = t_str.find(t_from); pos != std::string::npos;
+       pos = t_str.find(t_from, pos + t_to.size()))
+  {
+    t_str.replace(pos, t_from.size(), t_to);
+  }
+}
+}  // namespace
+
+std::size_t StaticAssets::load(const std::string& t_dir, int t_gzip_level)
+{
+  m_assets.clear();
+
+  std::unordered_map<std::string, std::string> files;
+  DIR* dir = opendir(t_dir.c_str());
+  if (!dir)
+  {
+    return 0;
+  }
+  while (const auto* entry = readdir(dir))
+  {
+    const std::string name = entry->d_name;
+    std::string content;
+    if (name.empty() || name[0] == '.' || !read_file(t_dir + "/" + name, content))
+    {
+      continue;
+    }
+    files.emplace(name, std::move(content));
+  }
+  closedir(dir);
+
+  // Point index.html to versioned URLs of the other assets. Its own version is
+  // taken after rewriting, so it changes whenever any asset does.
+  const auto index = files.find("index.html");
+  if (index != files.end())
+  {
+    for (const auto& file : files)
+    {
+      if (file.first != index->first)
+      {
+        replace_all(index->second, "\"./" + file.first + "\"",
+                    "\"./" + file.first + "?v=" + content_version(file.second) + "\"");
+      }
+    }
+  }
+
+  for (auto& file : files)
+  {
+    Asset asset;
+    const auto ext = file.first.substr(file.first.find_last_of('.') + 1);
+    const auto mime = crow::mime_types.find(ext);
+    asset.mime = mime != crow::mime_types.end() ? mime->second : "text/plain";
+    asset.version = content_version(file.second);
+    asset.etag = "\"" + asset.version + "\"";
+    if (t_gzip_level > 0 && is_text(asset.mime))
+    {
+      auto gzip = crow::compression::compress_string(
+          file.second.data(), file.second.size(), crow::compression::GZIP, t_gzip_level);
+      if (!gzip.empty() && gzip.size() < file.second.size())
+      {
+        asset.gzip = std::make_shared<const std::string>(std::move(gzip));
+        asset.gzip_etag = "\"" + asset.version + "-gzip\"";
+      }
+    }
+    asset.body = std::make_shared<const std::string>(std::move(file.second));
+    m_assets.emplace(file.first, std::move(asset));
+  }
+  return m_assets.size();
+}
+
+const StaticAssets::Asset* StaticAssets::find(const std::string& t_name) const
+{
+  const auto it = m_assets.find(t_name);
+  return it != m_assets.end() ? &it->second : nullptr;
+}
+
+std::size_t StaticAssets::size() const
+{
+  return m_assets.size();
+}
+
+std::size_t StaticAssets::bytes() const
+{
+  std::size_t bytes = 0;
+  for (const auto& asset : m_assets)
+  {
+    bytes += asset.second.body->size();
+    if (asset.second.gzip)
+    {
+      bytes += asset.second.gzip->size();
+    }
+  }
+  return bytes;
+}
+
+}  // namespace web
+}  // namespace httpgd
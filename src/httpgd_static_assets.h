@@ -0,0 +1,59 @@
+#ifndef __UNIGD_HTTPGD_STATIC_ASSETS_H__
+#define __UNIGD_HTTPGD_STATIC_ASSETS_H__
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace httpgd
+{
+namespace web
+{
+/**
+ * @brief Files of the web client, loaded into memory once.
+ *
+ * Every asset has a strong entity tag derived from its content and, for text
+ * files, a precomputed gzip encoding. References from `index.html` to the
+ * other assets are rewritten to carry the content version (`?v=<version>`),
+ * so versioned URLs can be cached indefinitely by browsers.
+ *
+ * The store is filled by `load()` before the server starts and is read-only
+ * afterwards, so concurrent lookups need no locking.
+ */
+class StaticAssets
+{
+ public:
+  struct Asset
+  {
+    std::shared_ptr<const std::string> body;
+    std::shared_ptr<const std::string> gzip;
+    std::string mime;
+    std::string version;
+    std::string etag;
+    std::string gzip_etag;
+  };
+
+  /**
+   * @brief Load all files of directory `t_dir`. Text files are also stored
+   * gzip encoded with zlib level `t_gzip_level` (0: no encodings).
+   *
+   * @return Number of loaded files.
+   */
+  std::size_t load(const std::string& t_dir, int t_gzip_level);
+
+  /**
+   * @brief Get an asset by file name, or null if there is none.
+   */
+  const Asset* find(const std::string& t_name) const;
+
+  std::size_t size() const;
+  std::size_t bytes() const;
+
+ private:
+  std::unordered_map<std::string, Asset> m_assets;
+};
+}  // namespace web
+}  // namespace httpgd
+
+#endif /* __UNIGD_HTTPGD_STATIC_ASSETS_H__ */
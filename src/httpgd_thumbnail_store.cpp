@@ -0,0 +1,152 @@
+#include "httpgd_thumbnail_store.h"
+
+#include <unordered_set>
+
+namespace httpgd
+{
+namespace web
+{
+ThumbnailStore::ThumbnailStore(std::size_t t_max_bytes) : m_max_bytes(t_max_bytes) {}
+
+std::shared_ptr<const RenderResult> ThumbnailStore::get(UNIGD_PLOT_ID t_id,
+                                                        int t_min_upid)
+{
+  std::lock_guard<std::mutex> lock(m_mtx);
+  const auto it = m_index.find(t_id);
+  if (it == m_index.end() || it->second->upid < t_min_upid)
+  {
+    return nullptr;
+  }
+  m_lru.splice(m_lru.begin(), m_lru, it->second);
+  return it->second->render;
+}
+
+bool ThumbnailStore::claim(UNIGD_PLOT_ID t_id, int t_upid)
+{
+  std::lock_guard<std::mutex> lock(m_mtx);
+  const auto it = m_index.find(t_id);
+  if (it != m_index.end() && it->second->upid >= t_upid)
+  {
+    return false;
+  }
+  const auto pending = m_pending.find(t_id);
+  if (pending != m_pending.end() && pending->second >= t_upid)
+  {
+    return false;
+  }
+  // Generating evicted thumbnails again would evict others in turn.
+  const auto evicted = m_evicted.find(t_id);
+  if (evicted != m_evicted.end() && evicted->second >= t_upid)
+  {
+    return false;
+  }
+  m_pending[t_id] = t_upid;
+  return true;
+}
+
+bool ThumbnailStore::is_current(UNIGD_PLOT_ID t_id, int t_upid) const
+{
+  std::lock_guard<std::mutex> lock(m_mtx);
+  const auto pending = m_pending.find(t_id);
+  return pending != m_pending.end() && pending->second == t_upid;
+}
+
+void ThumbnailStore::put(UNIGD_PLOT_ID t_id, int t_upid,
+                         std::shared_ptr<const RenderResult> t_render)
+{
+  std::lock_guard<std::mutex> lock(m_mtx);
+  // Claims are released by remove(), retain() and clear(), and replaced by newer
+  // claims. Renders without their claim are stale.
+  const auto pending = m_pending.find(t_id);
+  if (pending == m_pending.end() || pending->second != t_upid)
+  {
+    return;
+  }
+  m_pending.erase(pending);
+  if (!t_render)
+  {
+    return;
+  }
+  const auto it = m_index.find(t_id);
+  if (it != m_index.end())
+  {
+    erase(it->second);
+  }
+  m_evicted.erase(t_id);
+  m_bytes += t_render->size();
+  m_lru.push_front(entry{t_id, t_upid, std::move(t_render)});
+  m_index.emplace(t_id, m_lru.begin());
+  evict();
+}
+
+void ThumbnailStore::retain(const std::vector<UNIGD_PLOT_ID>& t_ids)
+{
+  const std::unordered_set<UNIGD_PLOT_ID> keep(t_ids.begin(), t_ids.end());
+  std::lock_guard<std::mutex> lock(m_mtx);
+  for (auto it = m_lru.begin(); it != m_lru.end();)
+  {
+    auto next = std::next(it);
+    if (!keep.count(it->id))
+    {
+      erase(it);
+    }
+    it = next;
+  }
+  for (auto it = m_pending.begin(); it != m_pending.end();)
+  {
+    it = keep.count(it->first) ? std::next(it) : m_pending.erase(it);
+  }
+  for (auto it = m_evicted.begin(); it != m_evicted.end();)
+  {
+    it = keep.count(it->first) ? std::next(it) : m_evicted.erase(it);
+  }
+}
+
+void ThumbnailStore::remove(UNIGD_PLOT_ID t_id)
+{
+  std::lock_guard<std::mutex> lock(m_mtx);
+  m_pending.erase(t_id);
+  m_evicted.erase(t_id);
+  const auto it = m_index.find(t_id);
+  if (it != m_index.end())
+  {
+    erase(it->second);
+  }
+}
+
+void ThumbnailStore::clear()
+{
+  std::lock_guard<std::mutex> lock(m_mtx);
+  m_lru.clear();
+  m_index.clear();
+  m_pending.clear();
+  m_evicted.clear();
+  m_bytes = 0;
+}
+
+ThumbnailStore::Stats ThumbnailStore::stats() const
+{
+  std::lock_guard<std::mutex> lock(m_mtx);
+  return {m_lru.size(), m_bytes, m_evictions};
+}
+
+void ThumbnailStore::erase(std::list<entry>::iterator t_it)
+{
+  m_bytes -= t_it->render->size();
+  m_index.erase(t_it->id);
+  m_lru.erase(t_it);
+}
+
+void ThumbnailStore::evict()
+{
+  while (m_bytes > m_max_bytes && !m_lru.empty())
+  {
+    const auto last = std::prev(m_lru.end());
+    m_evicted[last->id] = last->upid;
+    erase(last);
+    ++m_evictions;
+  }
+}
+
+}  // namespace web
+}  // namespace httpgd
@@ -0,0 +1,100 @@
+#ifndef __UNIGD_HTTPGD_THUMBNAIL_STORE_H__
+#define __UNIGD_HTTPGD_THUMBNAIL_STORE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "httpgd_render_cache.h"
+#include "unigd_impl.h"
+
+namespace httpgd
+{
+namespace web
+{
+/**
+ * @brief Thumbnail renders of the plot history, one per plot.
+ *
+ * Each entry remembers the update ID it was rendered at, so a thumbnail of a
+ * plot that is still being drawn can be told apart from an up to date one.
+ * The least recently used entries are evicted to stay within the byte budget.
+ * All methods are thread safe.
+ */
+class ThumbnailStore
+{
+ public:
+  struct Stats
+  {
+    std::size_t entries;
+    std::size_t bytes;
+    uint64_t evictions;
+  };
+
+  explicit ThumbnailStore(std::size_t t_max_bytes);
+
+  /**
+   * @brief Get the thumbnail of plot `t_id` if it was rendered at update ID
+   * `t_min_upid` or later.
+   */
+  std::shared_ptr<const RenderResult> get(UNIGD_PLOT_ID t_id, int t_min_upid);
+
+  /**
+   * @brief Mark plot `t_id` as being rendered at `t_upid`.
+   *
+   * @return false if an entry or a pending render at `t_upid` or later exists,
+   * or if such an entry was evicted. Evicted thumbnails are not generated again
+   * until the plot changes.
+   */
+  bool claim(UNIGD_PLOT_ID t_id, int t_upid);
+
+  /**
+   * @brief Whether the claim of plot `t_id` at `t_upid` still holds, i.e. it has
+   * not been released or superseded by a newer one.
+   */
+  bool is_current(UNIGD_PLOT_ID t_id, int t_upid) const;
+
+  /**
+   * @brief Store a thumbnail and release its claim. Renders whose claim was
+   * dropped or superseded are discarded, a null render only releases the claim.
+   */
+  void put(UNIGD_PLOT_ID t_id, int t_upid, std::shared_ptr<const RenderResult> t_render);
+
+  /**
+   * @brief Drop all entries of plots that are not in `t_ids`.
+   */
+  void retain(const std::vector<UNIGD_PLOT_ID>& t_ids);
+  void remove(UNIGD_PLOT_ID t_id);
+  void clear();
+
+  Stats stats() const;
+
+ private:
+  struct entry
+  {
+    UNIGD_PLOT_ID id;
+    int upid;
+    std::shared_ptr<const RenderResult> render;
+  };
+
+  std::size_t m_max_bytes;
+  std::size_t m_bytes = 0;
+  uint64_t m_evictions = 0;
+
+  mutable std::mutex m_mtx;
+  std::list<entry> m_lru;
+  std::unordered_map<UNIGD_PLOT_ID, std::list<entry>::iterator> m_index;
+  std::unordered_map<UNIGD_PLOT_ID, int> m_pending;
+  // Update IDs of evicted thumbnails.
+  std::unordered_map<UNIGD_PLOT_ID, int> m_evicted;
+
+  void erase(std::list<entry>::iterator t_it);
+  void evict();
+};
+}  // namespace web
+}  // namespace httpgd
+
+#endif /* __UNIGD_HTTPGD_THUMBNAIL_STORE_H__ */
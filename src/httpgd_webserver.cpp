@@ -2,12 +2,18 @@
 #include "httpgd_webserver.h"
 
 #define CROW_MAIN
+#include <algorithm>
+#include <atomic>
 #include <compat/optional.hpp>
 #include <memory>
+#include <tuple>
+#include <vector>
 
 #include <crow.h>
 #include <fmt/format.h>
 
+#include "httpgd_rng.h"
+#include "httpgd_shared_server.h"
 #include "httpgd_version.h"
 #include "optional_lex.h"
 
@@ -19,29 +25,63 @@ namespace
 {
 const char* HTTPGD_CLIENT_INFO = "httpgd " HTTPGD_VERSION;
 
-inline crow::json::wvalue device_state_json(const unigd_device_state& state)
+// Size of the thumbnails kept for the whole plot history, also the /thumbnails
+// default, and the memory they may use.
+const double THUMBNAIL_WIDTH = 160;
+const double THUMBNAIL_HEIGHT = 120;
+const std::size_t THUMBNAIL_STORE_SIZE = 16 * 1024 * 1024;
+
+// WebSocket clients are dropped once their send queue stays over the limit
+// this long, so short bursts (e.g. a large plot) do not disconnect them.
+const std::chrono::milliseconds WS_QUEUE_GRACE(3000);
+
+// Queue slots of WebSocket messages where only the newest one matters.
+enum WsSlot : int
 {
-  return crow::json::wvalue(
-      {{"upid", state.upid}, {"hsize", state.hsize}, {"active", state.active}});
-}
+  WS_SLOT_STATE = 1,
+  WS_SLOT_PLOT = 2
+};
 
-struct plot_return : public crow::returnable
+// Thumbnails are kept as PNG, which is far smaller than SVG at this size. unigd
+// only has a PNG renderer when built with Cairo.
+inline std::string thumbnail_renderer(unigd_api_v1* api)
 {
-  std::string dump() const override
+  unigd_renderer_info rinfo;
+  auto rinfo_handle = api->renderers_find("png", &rinfo);
+  if (!rinfo_handle)
   {
-    return std::string(m_render.buffer, m_render.buffer + m_render.size);
+    return "svg";
   }
+  api->renderers_find_destroy(rinfo_handle);
+  return "png";
+}
 
-  plot_return(const unigd_renderer_info& t_info, unigd_render_access t_render)
-      : crow::returnable(t_info.mime), m_render(std::move(t_render))
-  {
-  }
+inline crow::json::wvalue device_state_json(const unigd_device_state& state)
+{
+  return crow::json::wvalue(
+      {{"upid", state.upid}, {"hsize", state.hsize}, {"active", state.active}});
+}
 
-  ~plot_return() = default;
+// The render buffer is handed to the socket directly and kept alive by the response.
+// Only text renders (e.g. SVG) are worth compressing.
+inline crow::response plot_response(const std::string& mime, bool text,
+                                    std::shared_ptr<const RenderResult> render)
+{
+  crow::response res;
+  res.set_header("Content-Type", mime);
+  res.compressed = text;
+  const auto* data = reinterpret_cast<const char*>(render->data());
+  const auto size = render->size();
+  res.set_body_view(std::move(render), data, size);
+  return res;
+}
 
- private:
-  const unigd_render_access m_render;
-};
+// Round a requested pixel size to the nearest multiple of `step`, at least `step`.
+inline int snap_size(int size, unsigned step)
+{
+  const int grid = static_cast<int>(step);
+  return std::max(grid, (size + grid / 2) / grid * grid);
+}
 
 inline std::experimental::optional<UNIGD_PLOT_ID> req_find_id(unigd_api_v1* api,
                                                               UNIGD_HANDLE ugd_handle,
@@ -73,6 +113,136 @@ inline std::experimental::optional<UNIGD_PLOT_ID> req_find_id(unigd_api_v1* api,
   return re;
 }
 
+// Strong entity tag of a rendered plot. The server ID is included so tags do not
+// collide with renders of an earlier server on the same port.
+inline std::string plot_etag(const std::string& server_id, const RenderKey& key)
+{
+  return fmt::format("\"{}-{}-{}-{}-{}x{}x{}\"", server_id, key.id, key.upid,
+                     key.renderer, key.width, key.height, key.zoom);
+}
+
+// Evaluate an If-None-Match header (weak comparison, see RFC 9110 13.1.2).
+inline bool etag_matches(const std::string& header, const std::string& etag)
+{
+  std::size_t pos = 0;
+  while (pos < header.size())
+  {
+    auto end = header.find(',', pos);
+    if (end == std::string::npos)
+    {
+      end = header.size();
+    }
+    auto first = header.find_first_not_of(" \t", pos);
+    auto last = header.find_last_not_of(" \t", end - 1);
+    if (first != std::string::npos && first < end && last >= first)
+    {
+      if (header.compare(first, 2, "W/") == 0)
+      {
+        first += 2;
+      }
+      const auto candidate = header.substr(first, last - first + 1);
+      if (candidate == "*" || candidate == etag)
+      {
+        return true;
+      }
+    }
+    pos = end + 1;
+  }
+  return false;
+}
+
+// Serve a file of the web client from memory. Versioned URLs (`?v=`, see
+// StaticAssets) never change and may be cached for a year, other requests are
+// revalidated with the entity tag. Byte ranges are served by Crow.
+inline void static_response(crow::response& res, const crow::request& req,
+                            const StaticAssets::Asset& asset)
+{
+  const auto p_version = param_to<std::string>(req.url_params.get("v"));
+  res.set_header("Cache-Control", p_version && *p_version == asset.version
+                                      ? "public, max-age=31536000, immutable"
+                                      : "no-cache");
+  res.compressed = false;
+  crow::compression::algorithm algorithm;
+  const bool gzip =
+      asset.gzip &&
+      crow::compression::negotiate(req.get_header_value("Accept-Encoding"),
+                                   crow::compression::GZIP, algorithm) &&
+      algorithm == crow::compression::GZIP;
+  if (asset.gzip)
+  {
+    res.set_header("Vary", "Accept-Encoding");
+  }
+  const auto& etag = gzip ? asset.gzip_etag : asset.etag;
+  res.set_header("ETag", etag);
+  if (etag_matches(req.get_header_value("If-None-Match"), etag))
+  {
+    res.code = crow::status::NOT_MODIFIED;
+    return;
+  }
+  const auto& body = gzip ? asset.gzip : asset.body;
+  res.set_header("Content-Type", asset.mime);
+  if (gzip)
+  {
+    res.set_header("Content-Encoding", "gzip");
+  }
+  res.set_body_view(body, body->data(), body->size());
+  res.accept_ranges = true;
+}
+
+// Thumbnails of one /thumbnails request, rendered in parallel on the render pool.
+struct ThumbnailBatch
+{
+  std::vector<UNIGD_PLOT_ID> ids;
+  std::vector<std::shared_ptr<const RenderResult>> renders;
+  std::atomic<std::size_t> remaining;
+  std::atomic<bool> cancelled{false};
+  std::string mime;
+};
+
+// multipart/mixed body with one part per rendered thumbnail, in history order.
+inline std::string thumbnails_body(const ThumbnailBatch& batch,
+                                   const std::string& boundary)
+{
+  std::size_t size = boundary.size() + 8;
+  for (const auto& r : batch.renders)
+  {
+    size += r ? r->size() + boundary.size() + batch.mime.size() + 64 : 0;
+  }
+  std::string body;
+  body.reserve(size);
+  for (std::size_t i = 0; i < batch.renders.size(); ++i)
+  {
+    const auto& r = batch.renders[i];
+    if (!r)
+    {
+      continue;
+    }
+    body += fmt::format("--{}\r\nContent-Type: {}\r\nContent-ID: <{}>\r\n\r\n", boundary,
+                        batch.mime, batch.ids[i]);
+    body.append(reinterpret_cast<const char*>(r->data()), r->size());
+    body += "\r\n";
+  }
+  body += fmt::format("--{}--\r\n", boundary);
+  return body;
+}
+
+// Whether a request carries `token`, in the X-HTTPGD-TOKEN header or the `token`
+// parameter.
+inline bool token_matches(const crow::request& req, const std::string& token)
+{
+  std::experimental::optional<std::string> user_token = std::experimental::nullopt;
+  const auto f_header_token = req.headers.find("X-HTTPGD-TOKEN");
+  if (f_header_token != req.headers.end())
+  {
+    user_token = f_header_token->second;
+  }
+  else
+  {
+    user_token = param_to<std::string>(req.url_params.get("token"));
+  }
+  return user_token && user_token.value() == token;
+}
+
 }  // namespace
 
 void HttpgdLogHandler::log(std::string message, crow::LogLevel level)
@@ -129,22 +299,7 @@ std::string HttpgdLogHandler::timestamp()
 void WebServer::TokenGuard::before_handle(crow::request& req, crow::response& res,
                                           context& ctx)
 {
-  if (!m_use_token)
-  {
-    return;
-  }
-  std::experimental::optional<std::string> user_token = std::experimental::nullopt;
-  const auto f_header_token = req.headers.find("X-HTTPGD-TOKEN");
-  if (f_header_token != req.headers.end())
-  {
-    user_token = f_header_token->second;
-  }
-  else
-  {
-    user_token = param_to<std::string>(req.url_params.get("token"));
-  }
-
-  if (!user_token || (user_token.value() != m_token))
+  if (m_use_token && !token_matches(req, m_token))
   {
     res.code = crow::UNAUTHORIZED;
     res.end();
@@ -157,8 +312,33 @@ void WebServer::TokenGuard::after_handle(crow::request& req, crow::response& res
 }
 
 WebServer::WebServer(const HttpgdServerConfig& t_conf)
-    : m_conf(t_conf), m_app(), m_mtx_update_subs(), m_update_subs()
+    : m_conf(t_conf)
+    , m_app()
+    , m_mtx_update_subs()
+    , m_update_subs()
+    , m_render_cache(t_conf.render_cache_size)
+    , m_state_debouncer(std::chrono::milliseconds(t_conf.debounce_ms),
+                        [this] { publish_state(); })
+    , m_thumbnails(THUMBNAIL_STORE_SIZE)
 {
+  if (m_conf.shared)
+  {
+    // Starts the shared server with this configuration if it is not running.
+    m_shared = SharedServer::acquire(m_conf);
+    const auto& shared_conf = m_shared->get_config();
+    m_conf.host = shared_conf.host;
+    m_conf.port = shared_conf.port;
+    m_conf.socket_path = shared_conf.socket_path;
+    m_conf.io_threads = shared_conf.io_threads;
+    m_render_pool = m_shared->render_pool();
+    m_static_assets = m_shared->static_assets();
+  }
+  else
+  {
+    m_render_pool = std::make_shared<RenderPool>(m_conf.render_threads);
+    m_static_assets = std::make_shared<StaticAssets>();
+  }
+
   m_client.close = [](void* client_data)
   {
     static_cast<WebServer*>(client_data)->device_close();
@@ -183,6 +363,7 @@ bool WebServer::attach(int devnum)
   {
     m_api = ugd::api;
   }
+  m_thumbnail_renderer = thumbnail_renderer(m_api);
 
   m_ugd_handle = m_api->device_attach(devnum, &m_client, ugd::httpgd_client_id, this);
 
@@ -191,9 +372,32 @@ bool WebServer::attach(int devnum)
 
 std::string WebServer::status_info()
 {
-  const auto ws_count = m_update_subs.size();
-  return fmt::format("unigd: {}; httpgd: " HTTPGD_VERSION "; WebSocket connections: {}",
-                     m_api->info(), ws_count);
+  std::size_t ws_count;
+  uint64_t ws_queued = 0;
+  {
+    std::lock_guard<std::mutex> _(m_mtx_update_subs);
+    ws_count = m_update_subs.size();
+    for (auto u : m_update_subs)
+    {
+      ws_queued += u->queued_bytes();
+    }
+  }
+  const auto cache = m_render_cache.stats();
+  const auto updates = m_state_debouncer.stats();
+  const auto thumbnails = m_thumbnails.stats();
+  return fmt::format(
+      "unigd: {}; httpgd: " HTTPGD_VERSION
+      "; WebSocket connections: {} ({} bytes queued, {} dropped); Render cache: {} "
+      "hits, {} misses, {} shared, {} nearest, {} evictions, {} entries ({} bytes); "
+      "Threads: {} IO, {} render; State updates: {} sent, {} coalesced; Superseded "
+      "renders: {}; Thumbnails: {} ({} bytes, {} evictions); Static assets: {} ({} "
+      "bytes)",
+      m_api->info(), ws_count, ws_queued, m_ws_dropped.load(), cache.hits,
+      cache.misses, cache.shared, cache.nearest, cache.evictions, cache.entries,
+      cache.bytes,
+      m_conf.io_threads, m_render_pool->size(), updates.sent, updates.coalesced,
+      m_renders_superseded.load(), thumbnails.entries, thumbnails.bytes,
+      thumbnails.evictions, m_static_assets->size(), m_static_assets->bytes());
 }
 
 const HttpgdServerConfig& WebServer::get_config()
@@ -203,24 +407,122 @@ const HttpgdServerConfig& WebServer::get_config()
 
 unsigned short WebServer::port()
 {
+  if (m_shared)
+  {
+    return m_shared->port();
+  }
   m_app.wait_for_server_start();
   return m_app.port();
 }
 
+std::string WebServer::path() const
+{
+  return m_shared ? fmt::format("/dev/{}", m_shared_id) : std::string();
+}
+
 void WebServer::device_start()
 {
+  if (m_shared)
+  {
+    m_shared_id = m_shared->add(this);
+    return;
+  }
   m_server_thread = std::thread(&WebServer::run, this);
 }
 
-void WebServer::run()
+void WebServer::retain()
 {
-  crow::logger::setHandler(&m_log_handler);
+  std::lock_guard<std::mutex> _(m_mtx_uses);
+  ++m_uses;
+}
 
-  if (m_conf.cors)
+void WebServer::release()
+{
+  std::lock_guard<std::mutex> _(m_mtx_uses);
+  if (--m_uses == 0)
   {
-    auto& cors = m_app.get_middleware<crow::CORSHandler>();
-    cors.global().headers("Access-Control-Allow-Origin", "*");
+    m_cv_uses.notify_all();
   }
+}
+
+// Completes a deferred response on the connection's thread. The device stays in
+// use until then, so it is not closed while completions are still queued.
+void WebServer::respond(asio::io_context* t_io_context, std::function<void()> t_respond)
+{
+  retain();
+  asio::post(*t_io_context,
+             [this, t_respond = std::move(t_respond)]()
+             {
+               t_respond();
+               release();
+             });
+}
+
+// Answers a deferred request with 503, for render tasks that are discarded
+// because the render pool stops.
+RenderPool::task WebServer::unavailable(crow::response& res,
+                                        asio::io_context* t_io_context)
+{
+  return [this, &res, t_io_context]()
+  {
+    respond(t_io_context,
+            [&res]()
+            {
+              res.code = crow::status::SERVICE_UNAVAILABLE;
+              res.end();
+            });
+  };
+}
+
+void WebServer::wait_unused()
+{
+  std::unique_lock<std::mutex> lock(m_mtx_uses);
+  m_cv_uses.wait(lock, [this] { return m_uses == 0; });
+}
+
+// Render tasks use the device until they have run or been discarded by a
+// stopping pool, also on the shared render pool, which is not stopped when the
+// device closes.
+void WebServer::submit(RenderPool::task t_task, RenderPool::Priority t_priority,
+                       RenderPool::task t_cancel)
+{
+  retain();
+  m_render_pool->submit(
+      [this, t_task = std::move(t_task)]()
+      {
+        t_task();
+        release();
+      },
+      t_priority,
+      [this, t_cancel = std::move(t_cancel)]()
+      {
+        if (t_cancel)
+        {
+          t_cancel();
+        }
+        release();
+      });
+}
+
+const std::vector<WebServer::Endpoint>& WebServer::endpoints()
+{
+  static const std::vector<Endpoint> endpoints{
+      {"live", &WebServer::handle_live},
+      {"state", &WebServer::handle_state},
+      {"renderers", &WebServer::handle_renderers},
+      {"plots", &WebServer::handle_plots},
+      {"thumbnails", &WebServer::handle_thumbnails},
+      {"plot", &WebServer::handle_plot},
+      {"info", &WebServer::handle_info},
+      {"remove", &WebServer::handle_remove},
+      {"clear", &WebServer::handle_clear}};
+  return endpoints;
+}
+
+void WebServer::run()
+{
+  // The web client is served from memory, gzip encodings are made once here.
+  m_static_assets->load(m_conf.wwwpath, m_conf.compression_level > 0 ? 9 : 0);
 
   if (m_conf.use_token)
   {
@@ -233,251 +535,840 @@ void WebServer::run()
   // ([]()
   //  { return "httpgd server is running!"; });
 
-  CROW_ROUTE(m_app, "/live")
-      .CROW_MIDDLEWARES(m_app, TokenGuard)(
-          [&](const crow::request&, crow::response& res)
-          {
-            const auto filepath = std::string(m_conf.wwwpath) + "/index.html";
-            res.set_static_file_info_unsafe(filepath);
-            res.end();
-          });
-
-  CROW_ROUTE(m_app, "/state")
-      .CROW_MIDDLEWARES(m_app, TokenGuard)(
-          [&]()
-          {
-            if (m_api)
-            {
-              const auto state = m_api->device_state(m_ugd_handle);
-              return crow::response(device_state_json(state));
-            }
-            return crow::response(crow::status::NOT_FOUND);
-          });
+  for (const auto& endpoint : endpoints())
+  {
+    m_app.route_dynamic(std::string("/") + endpoint.name)
+        .CROW_MIDDLEWARES(m_app, TokenGuard)(
+            [this, handler = endpoint.handler](const crow::request& req,
+                                               crow::response& res)
+            { (this->*handler)(req, res); });
+  }
 
-  CROW_ROUTE(m_app, "/renderers")
-      .CROW_MIDDLEWARES(m_app, TokenGuard)(
-          [&]()
-          {
-            unigd_renderers_list renderers;
-            if (m_api)
-            {
-              auto renderers_handle = m_api->renderers(&renderers);
+  CROW_WEBSOCKET_ROUTE(m_app, "/")
+      .subprotocols({PUSH_PROTOCOL})
+      .onopen([&](crow::websocket::connection& conn) { ws_open(conn); })
+      .onclose([&](crow::websocket::connection& conn, const std::string& reason,
+                   uint16_t code)
+               {
+                 CROW_LOG_INFO << "websocket connection closed: " << reason;
+                 ws_close(conn, code);
+               })
+      .onmessage([&](crow::websocket::connection& conn, const std::string& data,
+                     bool is_binary) { ws_message(conn, data, is_binary); });
 
-              std::vector<crow::json::wvalue> a;
-              a.reserve(renderers.size);
-              for (uint64_t i = 0; i < renderers.size; ++i)
-              {
-                const auto& ren = renderers.entries[i];
-                a.push_back(crow::json::wvalue({{"id", ren.id},
-                                                {"mime", ren.mime},
-                                                {"ext", ren.fileext},
-                                                {"name", ren.name},
-                                                {"type", ren.type},
-                                                {"bin", !ren.text},
-                                                {"descr", ren.description}}));
-              }
+  CROW_ROUTE(m_app,
+             "/<str>")  // No token guard so static resources can be included in html
+  (
+      [&](const crow::request& req, crow::response& res, std::string s)
+      {
+        handle_static(req, res, s);
+      });
 
-              m_api->renderers_destroy(renderers_handle);
-              return crow::response(crow::json::wvalue({{"renderers", a}}));
-            }
-            return crow::response(crow::status::NOT_FOUND);
-          });
+  configure_app(m_app, m_conf);
+  try
+  {
+    m_app.run();
+  }
+  catch (const std::exception& e)
+  {
+    // E.g. the port is in use or the socket path is not writable.
+    CROW_LOG_ERROR << "Server failed: " << e.what();
+  }
+}
 
-  CROW_ROUTE(m_app, "/plots")
-      .CROW_MIDDLEWARES(m_app, TokenGuard)(
-          [&](const crow::request& req)
-          {
-            const auto p_index = param_to<int>(req.url_params.get("index"));
-            const auto p_limit = param_to<int>(req.url_params.get("limit"));
+void WebServer::handle(const std::string& t_name, const crow::request& req,
+                       crow::response& res)
+{
+  for (const auto& endpoint : endpoints())
+  {
+    if (t_name != endpoint.name)
+    {
+      continue;
+    }
+    if (m_conf.use_token && !token_matches(req, m_conf.token))
+    {
+      res.code = crow::UNAUTHORIZED;
+      res.end();
+      return;
+    }
+    (this->*endpoint.handler)(req, res);
+    return;
+  }
+  // No token guard so static resources can be included in html
+  handle_static(req, res, t_name);
+}
+
+void WebServer::handle_live(const crow::request& req, crow::response& res)
+{
+  const auto* asset = m_static_assets->find("index.html");
+  if (asset)
+  {
+    static_response(res, req, *asset);
+  }
+  else
+  {
+    res.code = crow::status::NOT_FOUND;
+  }
+  res.end();
+}
+
+void WebServer::handle_state(const crow::request& req, crow::response& res)
+{
+  if (m_api)
+  {
+    const auto state = m_api->device_state(m_ugd_handle);
+    res = crow::response(device_state_json(state));
+  }
+  else
+  {
+    res.code = crow::status::NOT_FOUND;
+  }
+  res.end();
+}
+
+void WebServer::handle_renderers(const crow::request& req, crow::response& res)
+{
+  unigd_renderers_list renderers;
+  if (!m_api)
+  {
+    res.code = crow::status::NOT_FOUND;
+    res.end();
+    return;
+  }
+  auto renderers_handle = m_api->renderers(&renderers);
+
+  std::vector<crow::json::wvalue> a;
+  a.reserve(renderers.size);
+  for (uint64_t i = 0; i < renderers.size; ++i)
+  {
+    const auto& ren = renderers.entries[i];
+    a.push_back(crow::json::wvalue({{"id", ren.id},
+                                    {"mime", ren.mime},
+                                    {"ext", ren.fileext},
+                                    {"name", ren.name},
+                                    {"type", ren.type},
+                                    {"bin", !ren.text},
+                                    {"descr", ren.description}}));
+  }
+
+  m_api->renderers_destroy(renderers_handle);
+  res = crow::response(crow::json::wvalue({{"renderers", a}}));
+  res.end();
+}
+
+void WebServer::handle_plots(const crow::request& req, crow::response& res)
+{
+  const auto p_index = param_to<int>(req.url_params.get("index"));
+  const auto p_limit = param_to<int>(req.url_params.get("limit"));
+
+  if (!m_api)
+  {
+    res.code = crow::status::NOT_FOUND;
+    res.end();
+    return;
+  }
+  UNIGD_FIND_HANDLE find_handle;
+  unigd_find_results qr;
+  find_handle = m_api->device_plots_find(m_ugd_handle, p_index.value_or(0),
+                                         p_limit.value_or(0), &qr);
+
+  std::vector<crow::json::wvalue> plot_list;
+  plot_list.reserve(qr.size);
+  for (UNIGD_PLOT_INDEX i = 0; i < qr.size; ++i)
+  {
+    plot_list.push_back(crow::json::wvalue({{"id", fmt::format("{}", qr.ids[i])}}));
+  }
+  const auto sj = device_state_json(qr.state);
+  m_api->device_plots_find_destroy(find_handle);
+
+  res = crow::response(crow::json::wvalue({{"state", sj}, {"plots", plot_list}}));
+  res.end();
+}
+
+void WebServer::handle_thumbnails(const crow::request& req, crow::response& res)
+{
+  const auto p_index = param_to<int>(req.url_params.get("index")).value_or(0);
+  const auto p_limit = param_to<int>(req.url_params.get("limit")).value_or(0);
+  const auto zoom = param_to<double>(req.url_params.get("zoom")).value_or(1);
+  const auto width =
+      param_to<double>(req.url_params.get("width")).value_or(THUMBNAIL_WIDTH);
+  const auto height =
+      param_to<double>(req.url_params.get("height")).value_or(THUMBNAIL_HEIGHT);
+  const auto p_renderer = param_to<std::string>(req.url_params.get("renderer"))
+                              .value_or(m_thumbnail_renderer);
+  const bool stored = width == THUMBNAIL_WIDTH && height == THUMBNAIL_HEIGHT &&
+                      zoom == 1 && p_renderer == m_thumbnail_renderer;
+
+  if (!m_api || !(zoom > 0) || width < 0 || height < 0)
+  {
+    res.code = m_api ? crow::status::BAD_REQUEST : crow::status::NOT_FOUND;
+    res.end();
+    return;
+  }
+
+  // The first request at the default size starts background generation, later
+  // state changes keep the stored thumbnails up to date.
+  if (stored && !m_thumbnails_requested.exchange(true))
+  {
+    m_state_debouncer.notify();
+  }
+
+  auto batch = std::make_shared<ThumbnailBatch>();
+  {
+    unigd_renderer_info rinfo;
+    auto rinfo_handle = m_api->renderers_find(p_renderer.c_str(), &rinfo);
+    if (!rinfo_handle)
+    {
+      res.code = crow::status::NOT_FOUND;
+      res.end();
+      return;
+    }
+    batch->mime = rinfo.mime;
+    res.compressed = rinfo.text;
+    m_api->renderers_find_destroy(rinfo_handle);
+  }
+
+  unigd_find_results qr;
+  const auto find_handle = m_api->device_plots_find(m_ugd_handle, p_index, p_limit, &qr);
+  batch->ids.assign(qr.ids, qr.ids + qr.size);
+  const auto upid = qr.state.upid;
+  m_api->device_plots_find_destroy(find_handle);
+
+  // Serve pre-generated thumbnails from memory. Only the newest plot can
+  // still change, its thumbnail must be up to date.
+  batch->renders.resize(batch->ids.size());
+  std::vector<std::size_t> missing;
+  const auto newest = stored ? newest_plot() : std::experimental::nullopt;
+  for (std::size_t i = 0; i < batch->ids.size(); ++i)
+  {
+    if (stored)
+    {
+      const auto id = batch->ids[i];
+      batch->renders[i] = m_thumbnails.get(id, newest == id ? upid : 0);
+    }
+    if (!batch->renders[i])
+    {
+      missing.push_back(i);
+    }
+  }
+
+  const auto boundary = "httpgd-" + httpgd::rng::token(24);
+  res.set_header("Content-Type", fmt::format("multipart/mixed; boundary={}", boundary));
+  if (missing.empty())
+  {
+    res.body = thumbnails_body(*batch, boundary);
+    res.end();
+    return;
+  }
 
-            if (m_api)
+  // Render missing thumbnails in parallel, behind interactive renders. The
+  // last one to finish (or be discarded) completes the response on the
+  // connection's thread.
+  batch->remaining = missing.size();
+  auto* io_context = req.io_context;
+  const auto complete = [this, &res, io_context, batch, boundary]()
+  {
+    if (--batch->remaining > 0)
+    {
+      return;
+    }
+    if (batch->cancelled)
+    {
+      unavailable(res, io_context)();
+      return;
+    }
+    auto body = std::make_shared<std::string>(thumbnails_body(*batch, boundary));
+    respond(io_context,
+            [&res, body]()
             {
-              UNIGD_FIND_HANDLE find_handle;
-              unigd_find_results qr;
-              find_handle = m_api->device_plots_find(m_ugd_handle, p_index.value_or(0),
-                                                     p_limit.value_or(0), &qr);
-
-              std::vector<crow::json::wvalue> plot_list;
-              plot_list.reserve(qr.size);
-              for (UNIGD_PLOT_INDEX i = 0; i < qr.size; ++i)
-              {
-                plot_list.push_back(
-                    crow::json::wvalue({{"id", fmt::format("{}", qr.ids[i])}}));
-              }
-              const auto sj = device_state_json(qr.state);
-              m_api->device_plots_find_destroy(find_handle);
+              res.body = std::move(*body);
+              res.end();
+            });
+  };
+  for (const auto i : missing)
+  {
+    const RenderKey key{batch->ids[i], upid, p_renderer, width / zoom, height / zoom,
+                        zoom};
+    submit(
+        [this, batch, key, i, complete]()
+        {
+          try
+          {
+            batch->renders[i] = render(key, true);
+          }
+          catch (const std::exception& e)
+          {
+            CROW_LOG_ERROR << "thumbnail render failed: " << e.what();
+          }
+          complete();
+        },
+        RenderPool::Priority::background,
+        [batch, complete]()
+        {
+          batch->cancelled = true;
+          complete();
+        });
+  }
+}
 
-              return crow::response(
-                  crow::json::wvalue({{"state", sj}, {"plots", plot_list}}));
-            }
-            return crow::response(crow::status::NOT_FOUND);
-          });
+void WebServer::handle_plot(const crow::request& req, crow::response& res)
+{
+  const auto p_width = param_to<int>(req.url_params.get("width"));
+  const auto p_height = param_to<int>(req.url_params.get("height"));
+  double width, height, zoom;
+  if (p_width && p_height)
+  {
+    zoom = param_to<double>(req.url_params.get("zoom")).value_or(1);
+    width = (*p_width) / zoom;
+    height = (*p_height) / zoom;
+  }
+  else
+  {
+    zoom = 1;
+    width = p_width.value_or(-1);
+    height = p_height.value_or(-1);
+  }
+  const auto p_id = req_find_id(m_api, m_ugd_handle, req).value_or(-1);
+  const auto p_renderer =
+      param_to<std::string>(req.url_params.get("renderer")).value_or("svg");
+  const auto p_download =
+      param_to<std::string>(req.url_params.get("download")).value_or("");
+  const auto p_client = param_to<std::string>(req.url_params.get("client")).value_or("");
+  const auto priority =
+      param_to<std::string>(req.url_params.get("priority")).value_or("") == "low"
+          ? RenderPool::Priority::background
+          : RenderPool::Priority::interactive;
+  if (!m_api)
+  {
+    res.code = crow::status::NOT_FOUND;
+    res.end();
+    return;
+  }
+
+  // With a size grid, SVG plots are rendered at the nearest grid size and
+  // other images may be answered with a cached render of a nearby size.
+  std::string nearby_mime;
+  if (m_conf.size_step > 0 && p_width && p_height && p_download.empty())
+  {
+    unigd_renderer_info rinfo;
+    auto rinfo_handle = m_api->renderers_find(p_renderer.c_str(), &rinfo);
+    if (rinfo_handle)
+    {
+      const std::string mime = rinfo.mime;
+      m_api->renderers_find_destroy(rinfo_handle);
+      if (mime == "image/svg+xml")
+      {
+        width = snap_size(*p_width, m_conf.size_step) / zoom;
+        height = snap_size(*p_height, m_conf.size_step) / zoom;
+      }
+      else if (mime.compare(0, 6, "image/") == 0)
+      {
+        nearby_mime = mime;
+      }
+    }
+  }
+
+  // Renders at the default size depend on the last rendered size and can
+  // neither be cached nor validated.
+  const bool cacheable = width >= 0 && height >= 0;
+  const auto upid = m_api->device_state(m_ugd_handle).upid;
+  const RenderKey key{p_id, upid, p_renderer, width, height, zoom};
+  const auto etag = cacheable ? plot_etag(m_conf.id, key) : std::string();
+
+  if (cacheable && etag_matches(req.get_header_value("If-None-Match"), etag))
+  {
+    res.code = crow::status::NOT_MODIFIED;
+    res.set_header("ETag", etag);
+    res.end();
+    return;
+  }
+
+  // Render on the render pool and complete the response on the IO thread
+  // of its connection. A newer request of the same client supersedes this
+  // one if it arrives before the render starts.
+  auto* io_context = req.io_context;
+  const auto generation = p_client.empty() ? 0 : client_generation(p_client);
 
-  CROW_ROUTE(m_app, "/plot")
-      .CROW_MIDDLEWARES(m_app, TokenGuard)(
-          [&](const crow::request& req)
+  if (!nearby_mime.empty())
+  {
+    // Answer with a cached render of a nearby size and put the exact size
+    // into the cache for the client's next request.
+    const auto nearby = m_render_cache.nearest(key, m_conf.size_step / zoom);
+    if (nearby.second && !(nearby.first == key))
+    {
+      res = plot_response(nearby_mime, false, nearby.second);
+      res.set_header("Cache-Control", "no-store");
+      res.set_header("X-HTTPGD-SIZE", fmt::format("{}x{}", nearby.first.width * zoom,
+                                                  nearby.first.height * zoom));
+      res.end();
+      submit(
+          [this, key, p_client, generation]()
           {
-            const auto p_width = param_to<int>(req.url_params.get("width"));
-            const auto p_height = param_to<int>(req.url_params.get("height"));
-            double width, height, zoom;
-            if (p_width && p_height)
+            if (!p_client.empty() && superseded(p_client, generation))
             {
-              zoom = param_to<double>(req.url_params.get("zoom")).value_or(1);
-              width = (*p_width) / zoom;
-              height = (*p_height) / zoom;
+              ++m_renders_superseded;
+              return;
             }
-            else
+            try
             {
-              zoom = 1;
-              width = p_width.value_or(-1);
-              height = p_height.value_or(-1);
+              render(key, true);
             }
-            const auto p_id = req_find_id(m_api, m_ugd_handle, req).value_or(-1);
-            const auto p_renderer =
-                param_to<std::string>(req.url_params.get("renderer")).value_or("svg");
-            const auto p_download = param_to<const char*>(req.url_params.get("download"));
-            if (m_api)
+            catch (const std::exception& e)
             {
-              unigd_renderer_info rinfo;
-              auto rinfo_handle = m_api->renderers_find(p_renderer.c_str(), &rinfo);
+              CROW_LOG_ERROR << "render failed: " << e.what();
+            }
+          },
+          priority);
+      return;
+    }
+  }
 
-              if (!rinfo_handle)
-              {
-                return crow::response(crow::status::NOT_FOUND);
-              }
+  const auto accept_encoding = req.get_header_value("Accept-Encoding");
+  submit(
+      [this, &res, io_context, key, cacheable, etag, accept_encoding, p_download,
+       p_client, generation]()
+      {
+        crow::response rendered;
+        if (!p_client.empty() && superseded(p_client, generation))
+        {
+          ++m_renders_superseded;
+          rendered.code = crow::status::CONFLICT;
+        }
+        else
+        {
+          rendered = render_plot(key, cacheable, accept_encoding);
+        }
+        if (rendered.code == crow::status::OK)
+        {
+          if (cacheable)
+          {
+            // An encoded body is a different representation of the plot.
+            // Its weak tag never satisfies If-Range, so only identical
+            // bytes are resumed.
+            const bool encoded = !rendered.get_header_value("Content-Encoding").empty();
+            rendered.set_header("ETag", encoded ? "W/" + etag : etag);
+            rendered.set_header("Cache-Control", "no-cache");
+            rendered.accept_ranges = true;
+          }
+          if (!p_download.empty())
+          {
+            rendered.add_header("Content-Disposition",
+                                fmt::format("attachment; filename=\"{}\"", p_download));
+          }
+        }
+        auto response = std::make_shared<crow::response>(std::move(rendered));
+        respond(io_context,
+                [&res, response]()
+                {
+                  res = std::move(*response);
+                  res.end();
+                });
+      },
+      priority, unavailable(res, io_context));
+}
 
-              unigd_render_access render;
-              auto render_handle = m_api->device_render_create(
-                  m_ugd_handle, p_renderer.c_str(), p_id, {width, height, zoom}, &render);
+void WebServer::handle_info(const crow::request& req, crow::response& res)
+{
+  res = crow::response(crow::json::wvalue({{"id", m_conf.id},
+                                           {"version", "httpgd " HTTPGD_VERSION},
+                                           {"unigd", m_api ? m_api->info() : ""}}));
+  res.end();
+}
 
-              if (!render_handle)
-              {
-                m_api->device_render_destroy(render_handle);
-                m_api->renderers_find_destroy(rinfo_handle);
-                return crow::response(crow::status::NOT_FOUND);
-              }
+void WebServer::handle_remove(const crow::request& req, crow::response& res)
+{
+  const auto p_id = req_find_id(m_api, m_ugd_handle, req);
+  if (p_id && m_api && m_api->device_plots_remove(m_ugd_handle, *p_id))
+  {
+    m_thumbnails.remove(*p_id);
+    const auto state = m_api->device_state(m_ugd_handle);
+    res = crow::response(device_state_json(state));
+  }
+  else
+  {
+    res.code = crow::status::NOT_FOUND;
+  }
+  res.end();
+}
 
-              auto res = crow::response(plot_return(rinfo, std::move(render)));
-              m_api->device_render_destroy(render_handle);
-              m_api->renderers_find_destroy(rinfo_handle);
+void WebServer::handle_clear(const crow::request& req, crow::response& res)
+{
+  if (!m_api)
+  {
+    res.code = crow::status::INTERNAL_SERVER_ERROR;
+  }
+  else if (m_api->device_plots_clear(m_ugd_handle))
+  {
+    m_thumbnails.clear();
+    const auto state = m_api->device_state(m_ugd_handle);
+    res = crow::response(device_state_json(state));
+  }
+  else
+  {
+    res.code = crow::status::NOT_FOUND;
+  }
+  res.end();
+}
 
-              if (p_download)
-              {
-                res.add_header("Content-Disposition",
-                               fmt::format("attachment; filename=\"{}\"", *p_download));
-              }
-              return res;
-            }
+void WebServer::handle_static(const crow::request& req, crow::response& res,
+                              const std::string& t_name)
+{
+  CROW_LOG_INFO << "static: " << t_name;
+  const auto* asset = m_static_assets->find(t_name);
+  if (asset)
+  {
+    static_response(res, req, *asset);
+  }
+  else
+  {
+    res.code = crow::status::NOT_FOUND;
+  }
+  res.end();
+}
 
-            return crow::response(crow::status::NOT_FOUND);
-          });
+void WebServer::ws_open(crow::websocket::connection& t_conn)
+{
+  CROW_LOG_INFO << "new websocket connection from " << t_conn.get_remote_ip();
+  t_conn.set_max_queued_bytes(m_conf.ws_queue_size, WS_QUEUE_GRACE);
+  std::lock_guard<std::mutex> _(m_mtx_update_subs);
+  if (m_closing)
+  {
+    t_conn.close("device closed");
+    return;
+  }
+  m_update_subs.insert(&t_conn);
+  m_ws_clients[&t_conn] =
+      WsClient{t_conn.get_subprotocol() == PUSH_PROTOCOL, false, Viewport()};
+}
 
-  CROW_ROUTE(m_app, "/info")
-      .CROW_MIDDLEWARES(m_app, TokenGuard)(
-          [&]()
-          {
-            return crow::json::wvalue({{"id", m_conf.id},
-                                       {"version", "httpgd " HTTPGD_VERSION},
-                                       {"unigd", m_api ? m_api->info() : ""}});
-          });
-
-  CROW_ROUTE(m_app, "/remove")
-      .CROW_MIDDLEWARES(m_app, TokenGuard)(
-          [&](const crow::request& req)
-          {
-            const auto p_id = req_find_id(m_api, m_ugd_handle, req);
-            if (!p_id)
-            {
-              return crow::response(crow::status::NOT_FOUND);
-            }
-            if (m_api)
-            {
-              if (m_api->device_plots_remove(m_ugd_handle, *p_id))
-              {
-                const auto state = m_api->device_state(m_ugd_handle);
-                return crow::response(device_state_json(state));
-              }
-            }
-            return crow::response(crow::status::NOT_FOUND);
-          });
+void WebServer::ws_close(crow::websocket::connection& t_conn, uint16_t t_code)
+{
+  if (t_code == crow::websocket::CloseStatusCode::PolicyViolated)
+  {
+    ++m_ws_dropped;
+  }
+  std::lock_guard<std::mutex> _(m_mtx_update_subs);
+  m_update_subs.erase(&t_conn);
+  const auto it = m_ws_clients.find(&t_conn);
+  if (it != m_ws_clients.end())
+  {
+    if (it->second.registered && --m_viewports[it->second.viewport] == 0)
+    {
+      m_viewports.erase(it->second.viewport);
+    }
+    m_ws_clients.erase(it);
+  }
+}
+
+void WebServer::ws_message(crow::websocket::connection& t_conn, const std::string& t_data,
+                           bool t_binary)
+{
+  // Viewport registrations are handled by the server, other messages
+  // are relayed to all clients.
+  const auto msg = t_binary ? crow::json::rvalue() : crow::json::load(t_data);
+  const bool viewport =
+      msg && msg.t() == crow::json::type::Object && msg.has("width") && msg.has("height");
+  if (viewport || t_conn.get_subprotocol() == PUSH_PROTOCOL)
+  {
+    if (!viewport || !register_viewport(t_conn, msg))
+    {
+      t_conn.close("invalid viewport",
+                   crow::websocket::CloseStatusCode::UnacceptableData);
+    }
+    return;
+  }
+  const auto frame = crow::websocket::make_frame(t_binary ? 0x2 : 0x1, t_data);
+  std::lock_guard<std::mutex> _(m_mtx_update_subs);
+  for (auto u : m_update_subs)
+  {
+    u->send_frame(frame);
+  }
+}
+
+std::shared_ptr<const RenderResult> WebServer::render(const RenderKey& t_key,
+                                                     bool t_cacheable)
+{
+  const auto create = [&]() -> std::shared_ptr<const RenderResult>
+  {
+    unigd_render_access render_access;
+    auto render_handle = m_api->device_render_create(
+        m_ugd_handle, t_key.renderer.c_str(), t_key.id,
+        {t_key.width, t_key.height, t_key.zoom}, &render_access);
+
+    if (!render_handle)
+    {
+      return nullptr;
+    }
+    return std::make_shared<RenderResult>(m_api, render_handle, render_access);
+  };
+
+  // Identical concurrent requests (e.g. all viewers reacting to the same state
+  // change) share one render.
+  return t_cacheable ? m_render_cache.get_or_render(t_key, create) : create();
+}
+
+crow::response WebServer::render_plot(const RenderKey& t_key, bool t_cacheable,
+                                      const std::string& t_accept_encoding)
+{
+  try
+  {
+    unigd_renderer_info rinfo;
+    auto rinfo_handle = m_api->renderers_find(t_key.renderer.c_str(), &rinfo);
+
+    if (!rinfo_handle)
+    {
+      return crow::response(crow::status::NOT_FOUND);
+    }
+
+    auto rendered = render(t_key, t_cacheable);
+    if (!rendered)
+    {
+      m_api->renderers_find_destroy(rinfo_handle);
+      return crow::response(crow::status::NOT_FOUND);
+    }
+
+    auto res = plot_response(rinfo.mime, rinfo.text, rendered);
+    if (rinfo.text)
+    {
+      encode_plot(res, *rendered, t_accept_encoding);
+    }
+    m_api->renderers_find_destroy(rinfo_handle);
+    return res;
+  }
+  catch (const std::exception& e)
+  {
+    CROW_LOG_ERROR << "render failed: " << e.what();
+    return crow::response(crow::status::INTERNAL_SERVER_ERROR);
+  }
+}
+
+// Compress a text render on the render thread instead of letting Crow compress
+// the response on the IO thread. The encoding is kept with the render, so
+// repeated requests for a cached plot are served without compressing again.
+void WebServer::encode_plot(crow::response& t_res, const RenderResult& t_render,
+                            const std::string& t_accept_encoding)
+{
+  if (m_conf.compression_level <= 0 || t_render.size() < m_conf.compression_min_size)
+  {
+    return;
+  }
+  t_res.compressed = false;
+  t_res.set_header("Vary", "Accept-Encoding");
+  crow::compression::algorithm algorithm;
+  if (!crow::compression::negotiate(t_accept_encoding, crow::compression::GZIP,
+                                    algorithm))
+  {
+    return;
+  }
+  const bool gzip = algorithm == crow::compression::GZIP;
+  const int level = m_conf.compression_level;
+  const auto encoded = t_render.encoded(
+      gzip ? "gzip" : "deflate",
+      [algorithm, level](const uint8_t* t_data, std::size_t t_size)
+      {
+        return crow::compression::compress_string(reinterpret_cast<const char*>(t_data),
+                                                  t_size, algorithm, level);
+      });
+  if (!encoded)
+  {
+    return;
+  }
+  t_res.set_body_view(encoded, encoded->data(), encoded->size());
+  t_res.set_header("Content-Encoding", gzip ? "gzip" : "deflate");
+}
+
+uint64_t WebServer::client_generation(const std::string& t_client)
+{
+  std::lock_guard<std::mutex> _(m_mtx_clients);
+  // Client IDs are chosen by clients, keep the table bounded.
+  if (m_client_generations.size() >= 1024 && !m_client_generations.count(t_client))
+  {
+    m_client_generations.clear();
+  }
+  return m_client_generations[t_client] = ++m_generation;
+}
+
+bool WebServer::superseded(const std::string& t_client, uint64_t t_generation)
+{
+  std::lock_guard<std::mutex> _(m_mtx_clients);
+  const auto it = m_client_generations.find(t_client);
+  return it != m_client_generations.end() && it->second != t_generation;
+}
+
+bool WebServer::Viewport::operator<(const Viewport& t_other) const
+{
+  return std::tie(renderer, width, height, zoom) <
+         std::tie(t_other.renderer, t_other.width, t_other.height, t_other.zoom);
+}
+
+bool WebServer::Viewport::operator==(const Viewport& t_other) const
+{
+  return renderer == t_other.renderer && width == t_other.width &&
+         height == t_other.height && zoom == t_other.zoom;
+}
+
+// Called on the connection's IO thread with a viewport message:
+// {"width": 720, "height": 576, "zoom": 1, "renderer": "svg", "token": "..."}
+bool WebServer::register_viewport(crow::websocket::connection& t_conn,
+                                  const crow::json::rvalue& t_msg)
+{
+  if (!m_api)
+  {
+    return false;
+  }
+  Viewport viewport;
+  try
+  {
+    if (m_conf.use_token &&
+        (!t_msg.has("token") || std::string(t_msg["token"].s()) != m_conf.token))
+    {
+      return false;
+    }
+    const double zoom = t_msg.has("zoom") ? t_msg["zoom"].d() : 1;
+    if (zoom <= 0)
+    {
+      return false;
+    }
+    viewport.renderer =
+        t_msg.has("renderer") ? std::string(t_msg["renderer"].s()) : "svg";
+    viewport.width = t_msg["width"].d() / zoom;
+    viewport.height = t_msg["height"].d() / zoom;
+    viewport.zoom = zoom;
+  }
+  catch (const std::exception&)
+  {
+    return false;
+  }
+  if (viewport.width < 0 || viewport.height < 0)
+  {
+    return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> _(m_mtx_update_subs);
+    const auto it = m_ws_clients.find(&t_conn);
+    if (it == m_ws_clients.end())
+    {
+      return false;
+    }
+    auto& client = it->second;
+    if (client.registered && --m_viewports[client.viewport] == 0)
+    {
+      m_viewports.erase(client.viewport);
+    }
+    client.registered = true;
+    client.viewport = viewport;
+    ++m_viewports[viewport];
+  }
+  prerender(viewport, m_api->device_state(m_ugd_handle).upid, &t_conn);
+  return true;
+}
 
-  CROW_ROUTE(m_app, "/clear")
-      .CROW_MIDDLEWARES(m_app, TokenGuard)(
-          [&]()
+// Render the newest plot for a viewport into the render cache, so the
+// follow-up /plot request of clients showing it is a cache hit. Push clients
+// showing the viewport (or only `t_receiver`, if set) get the plot as a binary
+// frame: 4 byte big endian header length, JSON header, plot body.
+void WebServer::prerender(const Viewport& t_viewport, int t_upid,
+                          crow::websocket::connection* t_receiver)
+{
+  submit(
+      [this, t_viewport, t_upid, t_receiver]()
+      {
+        try
+        {
+          const auto p_id = newest_plot();
+          if (!p_id)
           {
-            if (!m_api)
-            {
-              return crow::response(crow::status::INTERNAL_SERVER_ERROR);
-            }
-            if (m_api->device_plots_clear(m_ugd_handle))
-            {
-              const auto state = m_api->device_state(m_ugd_handle);
-              return crow::response(device_state_json(state));
-            }
-            return crow::response(crow::status::NOT_FOUND);
-          });
+            return;
+          }
+          const auto id = *p_id;
 
-  CROW_WEBSOCKET_ROUTE(m_app, "/")
-      .onopen(
-          [&](crow::websocket::connection& conn)
+          unigd_renderer_info rinfo;
+          auto rinfo_handle = m_api->renderers_find(t_viewport.renderer.c_str(), &rinfo);
+          if (!rinfo_handle)
           {
-            CROW_LOG_INFO << "new websocket connection from " << conn.get_remote_ip();
-            std::lock_guard<std::mutex> _(m_mtx_update_subs);
-            m_update_subs.insert(&conn);
-          })
-      .onclose(
-          [&](crow::websocket::connection& conn, const std::string& reason,
-              uint16_t /*code*/)
+            return;
+          }
+          const std::string mime = rinfo.mime;
+          m_api->renderers_find_destroy(rinfo_handle);
+
+          const RenderKey key{id, t_upid, t_viewport.renderer, t_viewport.width,
+                              t_viewport.height, t_viewport.zoom};
+          const auto rendered = render(key, true);
+          if (!rendered)
           {
-            CROW_LOG_INFO << "websocket connection closed: " << reason;
-            std::lock_guard<std::mutex> _(m_mtx_update_subs);
-            m_update_subs.erase(&conn);
-          })
-      .onmessage(
-          [&](crow::websocket::connection& /*conn*/, const std::string& data,
-              bool is_binary)
+            return;
+          }
+
+          std::vector<crow::websocket::connection*> receivers;
           {
             std::lock_guard<std::mutex> _(m_mtx_update_subs);
-            for (auto u : m_update_subs)
+            for (const auto& c : m_ws_clients)
             {
-              if (is_binary)
+              if (c.second.push && c.second.registered &&
+                  c.second.viewport == t_viewport &&
+                  (!t_receiver || c.first == t_receiver))
               {
-                u->send_binary(data);
-              }
-              else
-              {
-                u->send_text(data);
+                receivers.push_back(c.first);
               }
             }
-          });
+          }
+          if (receivers.empty())
+          {
+            return;
+          }
 
-  CROW_ROUTE(m_app,
-             "/<str>")  // No token guard so static resources can be included in html
-  (
-      [&](crow::response& res, std::string s)
-      {
-        CROW_LOG_INFO << "static: " << s;
-        const auto filepath = std::string(m_conf.wwwpath) + "/" + s;
-        res.set_static_file_info_unsafe(filepath);
-        res.end();
-      });
+          const auto header = crow::json::wvalue({{"upid", t_upid},
+                                                  {"id", fmt::format("{}", id)},
+                                                  {"renderer", t_viewport.renderer},
+                                                  {"mime", mime},
+                                                  {"width", t_viewport.width},
+                                                  {"height", t_viewport.height},
+                                                  {"zoom", t_viewport.zoom}})
+                                  .dump();
+          std::string payload;
+          payload.reserve(4 + header.size() + rendered->size());
+          const uint32_t header_size = static_cast<uint32_t>(header.size());
+          for (int shift = 24; shift >= 0; shift -= 8)
+          {
+            payload.push_back(static_cast<char>((header_size >> shift) & 0xff));
+          }
+          payload.append(header);
+          payload.append(reinterpret_cast<const char*>(rendered->data()),
+                         rendered->size());
+          const auto frame = crow::websocket::make_frame(0x2, payload);
 
-  // Prevent Crow from intercepting SIGINT/SIGTERM - R must handle its own
-  // signals, otherwise Ctrl+C breaks when running alongside plumber/Shiny.
-  m_app.signal_clear();
-  // Use a fixed thread count instead of hardware_concurrency() to avoid
-  // spawning excessive threads on high-core-count machines. Bump to 4 if
-  // concurrent requests (e.g. sidebar thumbnails) become a bottleneck.
-  m_app.bindaddr(m_conf.host).port(m_conf.port).concurrency(2).run();
+          // Receivers may have disconnected while the frame was built.
+          std::lock_guard<std::mutex> _(m_mtx_update_subs);
+          for (auto conn : receivers)
+          {
+            const auto it = m_ws_clients.find(conn);
+            if (it != m_ws_clients.end() && it->second.viewport == t_viewport)
+            {
+              conn->send_latest(frame, WS_SLOT_PLOT);
+            }
+          }
+        }
+        catch (const std::exception& e)
+        {
+          CROW_LOG_ERROR << "prerender failed: " << e.what();
+        }
+      });
 }
 
 void WebServer::device_close()
 {
-  // for (auto u : m_update_subs)
-  //{
-  //   u->userdata();
-  // }
+  if (m_shared)
+  {
+    close_shared();
+    return;
+  }
 
+  // Renders and updates must not outlive the device. Responses of finished or
+  // discarded renders are sent before the server stops.
+  m_state_debouncer.stop();
+  m_render_pool->stop();
+  wait_unused();
   m_app.stop();
 
   if (m_server_thread.joinable())
@@ -485,31 +1376,156 @@ void WebServer::device_close()
     m_server_thread.join();
   }
 
+  m_render_cache.clear();
+  m_thumbnails.clear();
+
+  if (m_api && m_ugd_handle)
+  {
+    m_api->device_destroy(m_ugd_handle);
+  }
+
+  delete this;  // attention!
+}
+
+// The shared server keeps running, so requests and renders of the device may
+// still be in progress. They complete before the device is destroyed.
+void WebServer::close_shared()
+{
+  m_state_debouncer.stop();
+  {
+    std::lock_guard<std::mutex> _(m_mtx_update_subs);
+    m_closing = true;
+    for (auto u : m_update_subs)
+    {
+      u->close("device closed");
+    }
+    m_update_subs.clear();
+    m_ws_clients.clear();
+    m_viewports.clear();
+  }
+  m_shared->remove(m_shared_id);
+  wait_unused();
+
+  m_render_cache.clear();
+  m_thumbnails.clear();
+
   if (m_api && m_ugd_handle)
   {
     m_api->device_destroy(m_ugd_handle);
   }
 
+  // The last device to close stops the shared server.
+  m_shared.reset();
   delete this;  // attention!
 }
 
 void WebServer::broadcast_state(const unigd_device_state& t_state)
 {
+  // Serialize and frame once, all subscribers share the same buffer. Only the
+  // newest state matters, so a state still queued for a slow client is replaced.
+  const auto frame = crow::websocket::make_frame(0x1, device_state_json(t_state).dump());
   std::lock_guard<std::mutex> _(m_mtx_update_subs);
   for (auto u : m_update_subs)
   {
-    u->send_text(device_state_json(t_state).dump());
+    u->send_latest(frame, WS_SLOT_STATE);
+  }
+  if (t_state.hsize > 0)
+  {
+    for (const auto& v : m_viewports)
+    {
+      prerender(v.first, t_state.upid);
+    }
   }
 }
 
 void WebServer::device_state_change()
+{
+  // Called on the R thread: only flag the change, the debouncer thread
+  // fetches and broadcasts the state.
+  m_state_debouncer.notify();
+}
+
+void WebServer::publish_state()
 {
   if (!m_api)
   {
     return;
   }
   const auto state = m_api->device_state(m_ugd_handle);
+  m_render_cache.invalidate(state.upid);
   broadcast_state(state);
+  update_thumbnails(state);
+}
+
+std::experimental::optional<UNIGD_PLOT_ID> WebServer::newest_plot()
+{
+  std::experimental::optional<UNIGD_PLOT_ID> id;
+  unigd_find_results qr;
+  const auto handle = m_api->device_plots_find(m_ugd_handle, -1, 1, &qr);
+  if (qr.size > 0)
+  {
+    id = qr.ids[0];
+  }
+  m_api->device_plots_find_destroy(handle);
+  return id;
+}
+
+// Generate missing thumbnails in the background, one render pool task per plot.
+// Thumbnails of removed plots are dropped.
+void WebServer::update_thumbnails(const unigd_device_state& t_state)
+{
+  if (!m_thumbnails_requested)
+  {
+    return;
+  }
+
+  unigd_find_results qr;
+  const auto handle = m_api->device_plots_find(m_ugd_handle, 0, 0, &qr);
+  const std::vector<UNIGD_PLOT_ID> ids(qr.ids, qr.ids + qr.size);
+  m_api->device_plots_find_destroy(handle);
+
+  m_thumbnails.retain(ids);
+  const auto previous_newest = m_thumbnails_newest;
+  m_thumbnails_newest = std::experimental::nullopt;
+  if (!ids.empty())
+  {
+    m_thumbnails_newest = ids.back();
+  }
+
+  for (const auto id : ids)
+  {
+    // The newest plot may still be drawn on, and the previously newest one may
+    // have changed since its thumbnail was made. Others are final.
+    const bool changing = id == m_thumbnails_newest || id == previous_newest;
+    const int upid = changing ? t_state.upid : 0;
+    if (!m_thumbnails.claim(id, upid))
+    {
+      continue;
+    }
+    submit(
+        [this, id, upid]()
+        {
+          // Skip renders that a newer state change has made obsolete while
+          // they were queued.
+          if (!m_thumbnails.is_current(id, upid))
+          {
+            return;
+          }
+          std::shared_ptr<const RenderResult> thumbnail;
+          try
+          {
+            thumbnail = render(RenderKey{id, upid, m_thumbnail_renderer, THUMBNAIL_WIDTH,
+                                         THUMBNAIL_HEIGHT, 1},
+                               false);
+          }
+          catch (const std::exception& e)
+          {
+            CROW_LOG_ERROR << "thumbnail render failed: " << e.what();
+          }
+          m_thumbnails.put(id, upid, std::move(thumbnail));
+        },
+        RenderPool::Priority::background);
+  }
 }
 
 }  // namespace web
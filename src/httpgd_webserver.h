@@ -1,14 +1,26 @@
 #ifndef __UNIGD_HTTPGD_WEBSERVER_H__
 #define __UNIGD_HTTPGD_WEBSERVER_H__
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
+#include <compat/optional.hpp>
 #include <crow.h>
 #include <crow/middlewares/cors.h>
 
+#include "httpgd_render_cache.h"
+#include "httpgd_render_pool.h"
+#include "httpgd_state_debouncer.h"
+#include "httpgd_static_assets.h"
+#include "httpgd_thumbnail_store.h"
 #include "unigd_impl.h"
 
 namespace httpgd
@@ -19,6 +31,8 @@ struct HttpgdServerConfig
 {
   std::string host;
   int port;
+  std::string socket_path;  // Unix domain socket to listen on instead of host/port
+  bool shared;              // Serve from the process-wide shared server
   std::string wwwpath;
   bool cors;
   bool use_token;
@@ -26,8 +40,20 @@ struct HttpgdServerConfig
   bool record_history;
   bool silent;
   std::string id;
+  std::size_t render_cache_size;
+  unsigned io_threads;
+  unsigned render_threads;
+  unsigned debounce_ms;
+  std::size_t ws_queue_size;
+  unsigned size_step;
+  int compression_level;
+  std::size_t compression_min_size;
 };
 
+// WebSocket subprotocol of clients that receive rendered plots instead of
+// fetching them.
+constexpr const char* PUSH_PROTOCOL = "httpgd-push";
+
 class HttpgdLogHandler : public crow::ILogHandler
 {
  public:
@@ -37,8 +63,82 @@ class HttpgdLogHandler : public crow::ILogHandler
   static std::string timestamp();
 };
 
+/**
+ * @brief Apply the listening, threading and compression settings of `t_conf`
+ * to a Crow app.
+ */
+template <typename App>
+void configure_app(App& t_app, const HttpgdServerConfig& t_conf)
+{
+  static HttpgdLogHandler log_handler;
+  crow::logger::setHandler(&log_handler);
+
+  if (t_conf.cors)
+  {
+    auto& cors = t_app.template get_middleware<crow::CORSHandler>();
+    cors.global().headers("Access-Control-Allow-Origin", "*");
+  }
+
+  // Prevent Crow from intercepting SIGINT/SIGTERM - R must handle its own
+  // signals, otherwise Ctrl+C breaks when running alongside plumber/Shiny.
+  t_app.signal_clear();
+  // Responses are compressed for clients that accept gzip or deflate, unless a
+  // handler opts out (binary renders, static files streamed from disk).
+  if (t_conf.compression_level > 0)
+  {
+    t_app.use_compression(crow::compression::GZIP)
+        .compression_level(t_conf.compression_level)
+        .compression_min_size(t_conf.compression_min_size);
+  }
+  // Renders run on the render pool, so few IO threads are needed (see
+  // httpgd::cpu::io_threads() for the automatic setting).
+  t_app.bindaddr(t_conf.host)
+      .port(t_conf.port)
+      .concurrency(static_cast<std::uint16_t>(t_conf.io_threads));
+#ifdef CROW_HAS_UNIX_SOCKET
+  // Local clients (e.g. editor extensions) connect without a TCP port.
+  if (!t_conf.socket_path.empty())
+  {
+    t_app.local_socket_path(t_conf.socket_path);
+  }
+#endif
+}
+
+class SharedServer;
+
 class WebServer
 {
+  /**
+   * @brief Plot size and renderer shown by a WebSocket client.
+   */
+  struct Viewport
+  {
+    std::string renderer;
+    double width;
+    double height;
+    double zoom;
+
+    bool operator<(const Viewport& t_other) const;
+    bool operator==(const Viewport& t_other) const;
+  };
+
+  struct WsClient
+  {
+    bool push;
+    bool registered;
+    Viewport viewport;
+  };
+
+  /**
+   * @brief API endpoint, served at `/<name>` (`/dev/<id>/<name>` on the
+   * shared server).
+   */
+  struct Endpoint
+  {
+    const char* name;
+    void (WebServer::*handler)(const crow::request&, crow::response&);
+  };
+
   struct TokenGuard : crow::ILocalMiddleware
   {
     struct context
@@ -68,6 +168,30 @@ class WebServer
   unsigned short port();
   void broadcast_state(const unigd_device_state& state);
 
+  /**
+   * @brief Path prefix of the device on the shared server (e.g. `/dev/1`), or
+   * an empty string for a device with its own server.
+   */
+  std::string path() const;
+
+  /**
+   * @brief Answer a request for API endpoint or web client file `t_name` of a
+   * device on the shared server.
+   */
+  void handle(const std::string& t_name, const crow::request& req, crow::response& res);
+
+  void ws_open(crow::websocket::connection& t_conn);
+  void ws_close(crow::websocket::connection& t_conn, uint16_t t_code);
+  void ws_message(crow::websocket::connection& t_conn, const std::string& t_data,
+                  bool t_binary);
+
+  /**
+   * @brief Count a handler, task or deferred response using the device. The
+   * device is only destroyed after all uses are released.
+   */
+  void retain();
+  void release();
+
  private:
   unigd_api_v1* m_api = nullptr;
   UNIGD_HANDLE m_ugd_handle = nullptr;
@@ -75,12 +199,74 @@ class WebServer
 
   HttpgdServerConfig m_conf;
   crow::App<crow::CORSHandler, TokenGuard> m_app;
-  HttpgdLogHandler m_log_handler;
   std::mutex m_mtx_update_subs;
   std::unordered_set<crow::websocket::connection*> m_update_subs;
+  std::atomic<uint64_t> m_ws_dropped{0};
+  std::unordered_map<crow::websocket::connection*, WsClient> m_ws_clients;
+  // Distinct registered viewports and the number of clients showing each.
+  std::map<Viewport, std::size_t> m_viewports;
+  std::mutex m_mtx_clients;
+  // Generation of the newest /plot request of each client (`client` parameter).
+  std::unordered_map<std::string, uint64_t> m_client_generations;
+  uint64_t m_generation = 0;
+  std::atomic<uint64_t> m_renders_superseded{0};
+  // Set once the device closes, new WebSocket connections are refused.
+  bool m_closing = false;
   std::thread m_server_thread;
+  // Device on the shared server: its ID there and the handlers and render tasks
+  // still using it.
+  std::shared_ptr<SharedServer> m_shared;
+  uint64_t m_shared_id = 0;
+  std::mutex m_mtx_uses;
+  std::condition_variable m_cv_uses;
+  std::size_t m_uses = 0;
+  RenderCache m_render_cache;
+  std::shared_ptr<RenderPool> m_render_pool;
+  StateDebouncer m_state_debouncer;
+  ThumbnailStore m_thumbnails;
+  // Renderer of the stored thumbnails, set before the device starts.
+  std::string m_thumbnail_renderer;
+  std::shared_ptr<StaticAssets> m_static_assets;
+  // Thumbnails are only generated once a client has asked for them.
+  std::atomic<bool> m_thumbnails_requested{false};
+  // Newest plot at the last thumbnail update (debouncer thread only).
+  std::experimental::optional<UNIGD_PLOT_ID> m_thumbnails_newest;
+
+  static const std::vector<Endpoint>& endpoints();
 
   void run();
+  void close_shared();
+  void submit(RenderPool::task t_task,
+              RenderPool::Priority t_priority = RenderPool::Priority::interactive,
+              RenderPool::task t_cancel = nullptr);
+  void respond(asio::io_context* t_io_context, std::function<void()> t_respond);
+  RenderPool::task unavailable(crow::response& res, asio::io_context* t_io_context);
+  void wait_unused();
+  void handle_live(const crow::request& req, crow::response& res);
+  void handle_state(const crow::request& req, crow::response& res);
+  void handle_renderers(const crow::request& req, crow::response& res);
+  void handle_plots(const crow::request& req, crow::response& res);
+  void handle_thumbnails(const crow::request& req, crow::response& res);
+  void handle_plot(const crow::request& req, crow::response& res);
+  void handle_info(const crow::request& req, crow::response& res);
+  void handle_remove(const crow::request& req, crow::response& res);
+  void handle_clear(const crow::request& req, crow::response& res);
+  void handle_static(const crow::request& req, crow::response& res,
+                     const std::string& t_name);
+  void publish_state();
+  void update_thumbnails(const unigd_device_state& t_state);
+  std::experimental::optional<UNIGD_PLOT_ID> newest_plot();
+  std::shared_ptr<const RenderResult> render(const RenderKey& t_key, bool t_cacheable);
+  crow::response render_plot(const RenderKey& t_key, bool t_cacheable,
+                             const std::string& t_accept_encoding = "");
+  void encode_plot(crow::response& t_res, const RenderResult& t_render,
+                   const std::string& t_accept_encoding);
+  uint64_t client_generation(const std::string& t_client);
+  bool superseded(const std::string& t_client, uint64_t t_generation);
+  bool register_viewport(crow::websocket::connection& t_conn,
+                         const crow::json::rvalue& t_msg);
+  void prerender(const Viewport& t_viewport, int t_upid,
+                 crow::websocket::connection* t_receiver = nullptr);
 };
 }  // namespace web
 }  // namespace httpgd
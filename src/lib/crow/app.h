@@ -40,6 +40,10 @@
 #ifdef CROW_ENABLE_COMPRESSION
 #include "crow/compression.h"
 #endif // #ifdef CROW_ENABLE_COMPRESSION
+#ifdef CROW_HAS_UNIX_SOCKET
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 
 #ifdef CROW_MSVC_WORKAROUND
@@ -202,11 +206,15 @@ namespace crow
         using self_t = Crow;
 
         /// \brief The HTTP server
-        using server_t = Server<Crow, SocketAdaptor, Middlewares...>;
+        using server_t = Server<Crow, TCPAcceptor, SocketAdaptor, Middlewares...>;
 
 #ifdef CROW_ENABLE_SSL
         /// \brief An HTTP server that runs on SSL with an SSLAdaptor
-        using ssl_server_t = Server<Crow, SSLAdaptor, Middlewares...>;
+        using ssl_server_t = Server<Crow, TCPAcceptor, SSLAdaptor, Middlewares...>;
+#endif
+#ifdef CROW_HAS_UNIX_SOCKET
+        /// \brief An HTTP server listening on a Unix domain socket
+        using unix_server_t = Server<Crow, UnixSocketAcceptor, UnixSocketAdaptor, Middlewares...>;
 #endif
         Crow()
         {}
@@ -316,6 +324,13 @@ namespace crow
                 return ssl_server_->port();
             }
             else
+#endif
+#ifdef CROW_HAS_UNIX_SOCKET
+            if (unix_server_)
+            {
+                return unix_server_->port();
+            }
+            else
 #endif
             {
                 return server_->port();
@@ -349,6 +364,23 @@ namespace crow
             return bindaddr_;
         }
 
+#ifdef CROW_HAS_UNIX_SOCKET
+        /// \brief Listen on a Unix domain socket at `path` instead of the TCP address and port
+        ///
+        /// A stale socket file at `path` is replaced. The file is removed when the server stops.
+        self_t& local_socket_path(std::string path)
+        {
+            local_socket_path_ = std::move(path);
+            return *this;
+        }
+
+        /// \brief Get the Unix domain socket path (empty when listening on TCP)
+        std::string local_socket_path() const
+        {
+            return local_socket_path_;
+        }
+#endif
+
         /// \brief Run the server on multiple threads using all available threads
         self_t& multithreaded()
         {
@@ -384,21 +416,6 @@ namespace crow
             return *this;
         }
 
-        /// \brief Set the response body size (in bytes) beyond which Crow automatically streams responses (Default is 1MiB)
-        ///
-        /// Any streamed response is unaffected by Crow's timer, and therefore won't timeout before a response is fully sent.
-        self_t& stream_threshold(size_t threshold)
-        {
-            res_stream_threshold_ = threshold;
-            return *this;
-        }
-
-        /// \brief Get the response body size (in bytes) beyond which Crow automatically streams responses
-        size_t& stream_threshold()
-        {
-            return res_stream_threshold_;
-        }
-
 
         self_t& register_blueprint(Blueprint& blueprint)
         {
@@ -450,6 +467,30 @@ namespace crow
         {
             return compression_used_;
         }
+
+        /// \brief Set the zlib compression level (1-9)
+        self_t& compression_level(int level)
+        {
+            comp_level_ = level;
+            return *this;
+        }
+
+        int compression_level() const
+        {
+            return comp_level_;
+        }
+
+        /// \brief Send response bodies smaller than this uncompressed
+        self_t& compression_min_size(size_t size)
+        {
+            comp_min_size_ = size;
+            return *this;
+        }
+
+        size_t compression_min_size() const
+        {
+            return comp_min_size_;
+        }
 #endif
 
         /// \brief Apply blueprints
@@ -506,6 +547,36 @@ namespace crow
 #endif
             validate();
 
+#ifdef CROW_HAS_UNIX_SOCKET
+            if (!local_socket_path_.empty())
+            {
+                // Only stale sockets are replaced: a socket a server still accepts
+                // connections on is in use, and a regular file at the path makes binding fail.
+                struct stat statbuf;
+                if (stat(local_socket_path_.c_str(), &statbuf) == 0 && S_ISSOCK(statbuf.st_mode))
+                {
+                    asio::io_context probe_context;
+                    stream_protocol::socket probe(probe_context);
+                    error_code ec;
+                    probe.connect(stream_protocol::endpoint(local_socket_path_), ec);
+                    if (!ec)
+                        throw asio::system_error(asio::error::address_in_use, local_socket_path_);
+                    if (ec == asio::error::connection_refused)
+                        unlink(local_socket_path_.c_str());
+                }
+                unix_server_ = std::move(std::unique_ptr<unix_server_t>(new unix_server_t(this, stream_protocol::endpoint(local_socket_path_), server_name_, &middlewares_, concurrency_, timeout_, nullptr)));
+                unix_server_->set_tick_function(tick_interval_, tick_function_);
+                for (auto snum : signals_)
+                {
+                    unix_server_->signal_add(snum);
+                }
+                notify_server_start();
+                unix_server_->run();
+                unlink(local_socket_path_.c_str());
+                return;
+            }
+#endif
+
             error_code ec;
             asio::ip::address addr = asio::ip::make_address(bindaddr_,ec);
             if (ec){
@@ -571,6 +642,9 @@ namespace crow
                     websocket->close("Server Application Terminated");
                 }
                 if (server_) { server_->stop(); }
+#ifdef CROW_HAS_UNIX_SOCKET
+                if (unix_server_) { unix_server_->stop(); }
+#endif
             }
         }
 
@@ -720,6 +794,12 @@ namespace crow
                 {
                     status = server_->wait_for_start(wait_until);
                 }
+#ifdef CROW_HAS_UNIX_SOCKET
+                else if (unix_server_)
+                {
+                    status = unix_server_->wait_for_start(wait_until);
+                }
+#endif
 #ifdef CROW_ENABLE_SSL
                 else if (ssl_server_)
                 {
@@ -763,13 +843,14 @@ namespace crow
         uint64_t max_payload_{UINT64_MAX};
         std::string server_name_ = std::string("Crow/") + VERSION;
         std::string bindaddr_ = "0.0.0.0";
-        size_t res_stream_threshold_ = 1048576;
         Router router_;
         bool static_routes_added_{false};
 
 #ifdef CROW_ENABLE_COMPRESSION
         compression::algorithm comp_algorithm_;
         bool compression_used_{false};
+        int comp_level_{Z_DEFAULT_COMPRESSION};
+        size_t comp_min_size_{1};
 #endif
 
         std::chrono::milliseconds tick_interval_;
@@ -785,6 +866,11 @@ namespace crow
 
         std::unique_ptr<server_t> server_;
 
+#ifdef CROW_HAS_UNIX_SOCKET
+        std::unique_ptr<unix_server_t> unix_server_;
+        std::string local_socket_path_;
+#endif
+
         std::vector<int> signals_{SIGINT, SIGTERM};
 
         bool server_started_{false};
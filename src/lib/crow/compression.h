@@ -1,6 +1,11 @@
 #ifdef CROW_ENABLE_COMPRESSION
 #pragma once
 
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <limits>
+#include <memory>
 #include <string>
 #include <zlib.h>
 
@@ -19,41 +24,117 @@ namespace crow // NOTE: Already documented in "crow/app.h"
             GZIP = 15 | 16,
         };
 
-        inline std::string compress_string(std::string const& str, algorithm algo)
+        /// A deflate stream that is initialized once and reset for every message.
+        class deflate_stream
         {
-            std::string compressed_str;
-            z_stream stream{};
-            // Initialize with the default values
-            if (::deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, algo, 8, Z_DEFAULT_STRATEGY) == Z_OK)
+        public:
+            deflate_stream(algorithm algo, int level):
+              level_(level)
             {
-                char buffer[8192];
+                ok_ = ::deflateInit2(&stream_, level, Z_DEFLATED, algo, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+            }
 
-                stream.avail_in = str.size();
-                // zlib does not take a const pointer. The data is not altered.
-                stream.next_in = const_cast<Bytef*>(reinterpret_cast<const Bytef*>(str.c_str()));
+            ~deflate_stream()
+            {
+                if (ok_)
+                    ::deflateEnd(&stream_);
+            }
 
-                int code = Z_OK;
-                do
-                {
-                    stream.avail_out = sizeof(buffer);
-                    stream.next_out = reinterpret_cast<Bytef*>(&buffer[0]);
+            deflate_stream(const deflate_stream&) = delete;
+            deflate_stream& operator=(const deflate_stream&) = delete;
 
-                    code = ::deflate(&stream, Z_FINISH);
-                    // Successful and non-fatal error code returned by deflate when used with Z_FINISH flush
-                    if (code == Z_OK || code == Z_STREAM_END)
-                    {
-                        std::copy(&buffer[0], &buffer[sizeof(buffer) - stream.avail_out], std::back_inserter(compressed_str));
-                    }
+            int level() const { return level_; }
 
-                } while (code == Z_OK);
+            /// Compress a whole message in one call into a buffer of deflateBound() size.
+            std::string compress(const char* data, std::size_t size)
+            {
+                std::string compressed_str;
+                if (!ok_ || size > std::numeric_limits<uInt>::max() || ::deflateReset(&stream_) != Z_OK)
+                    return compressed_str;
+
+                compressed_str.resize(::deflateBound(&stream_, static_cast<uLong>(size)));
+                // zlib does not take a const pointer. The data is not altered.
+                stream_.next_in = const_cast<Bytef*>(reinterpret_cast<const Bytef*>(data));
+                stream_.avail_in = static_cast<uInt>(size);
+                stream_.next_out = reinterpret_cast<Bytef*>(&compressed_str[0]);
+                stream_.avail_out = static_cast<uInt>(compressed_str.size());
 
-                if (code != Z_STREAM_END)
+                if (::deflate(&stream_, Z_FINISH) != Z_STREAM_END)
                     compressed_str.clear();
+                else
+                    compressed_str.resize(compressed_str.size() - stream_.avail_out);
+                return compressed_str;
+            }
+
+        private:
+            z_stream stream_{};
+            int level_;
+            bool ok_{false};
+        };
+
+        /// Compress with a stream of the calling thread, which is reused for later calls
+        /// with the same algorithm and level. Returns an empty string on failure.
+        inline std::string compress_string(const char* data, std::size_t size, algorithm algo, int level = Z_DEFAULT_COMPRESSION)
+        {
+            thread_local std::unique_ptr<deflate_stream> streams[2];
+            auto& stream = streams[algo == GZIP ? 1 : 0];
+            if (!stream || stream->level() != level)
+                stream.reset(new deflate_stream(algo, level));
+            return stream->compress(data, size);
+        }
 
-                ::deflateEnd(&stream);
+        /// Pick the content coding for an Accept-Encoding header. `preferred` is used if the
+        /// client accepts both; codings with q=0 are refused.
+        inline bool negotiate(const std::string& accept_encoding, algorithm preferred, algorithm& result)
+        {
+            double q_gzip = -1, q_deflate = -1, q_any = -1;
+            std::size_t pos = 0;
+            while (pos < accept_encoding.size())
+            {
+                auto end = accept_encoding.find(',', pos);
+                if (end == std::string::npos)
+                    end = accept_encoding.size();
+                std::string coding = accept_encoding.substr(pos, end - pos);
+                pos = end + 1;
+
+                double q = 1;
+                const auto params = coding.find(';');
+                if (params != std::string::npos)
+                {
+                    const auto q_pos = coding.find("q=", params);
+                    if (q_pos != std::string::npos)
+                        q = std::strtod(coding.c_str() + q_pos + 2, nullptr);
+                    coding.erase(params);
+                }
+                const auto first = coding.find_first_not_of(" \t");
+                if (first == std::string::npos)
+                    continue;
+                coding = coding.substr(first, coding.find_last_not_of(" \t") - first + 1);
+                std::transform(coding.begin(), coding.end(), coding.begin(), ::tolower);
+
+                if (coding == "gzip" || coding == "x-gzip")
+                    q_gzip = q;
+                else if (coding == "deflate")
+                    q_deflate = q;
+                else if (coding == "*")
+                    q_any = q;
             }
+            if (q_gzip < 0) q_gzip = q_any;
+            if (q_deflate < 0) q_deflate = q_any;
+
+            const bool gzip = q_gzip > 0, deflate = q_deflate > 0;
+            if (!gzip && !deflate)
+                return false;
+            if (gzip && deflate)
+                result = preferred;
+            else
+                result = gzip ? GZIP : DEFLATE;
+            return true;
+        }
 
-            return compressed_str;
+        inline std::string compress_string(std::string const& str, algorithm algo)
+        {
+            return compress_string(str.data(), str.size(), algo);
         }
 
         inline std::string decompress_string(std::string const& deflated_string)
@@ -12,6 +12,7 @@
 #include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <fstream>
 #include <memory>
 #include <vector>
 
@@ -66,7 +67,6 @@ namespace crow
           middlewares_(middlewares),
           get_cached_date_str(get_cached_date_str_f),
           task_timer_(task_timer),
-          res_stream_threshold_(handler->stream_threshold()),
           queue_length_(queue_length)
         {
 #ifdef CROW_ENABLE_DEBUG
@@ -124,14 +124,30 @@ namespace crow
             // HTTP 1.1 Expect: 100-continue
             if (req_.http_ver_major == 1 && req_.http_ver_minor == 1 && get_header_value(req_.headers, "expect") == "100-continue")
             {
-                continue_requested = true;
-                buffers_.clear();
-                static std::string expect_100_continue = "HTTP/1.1 100 Continue\r\n\r\n";
-                buffers_.emplace_back(expect_100_continue.data(), expect_100_continue.size());
-                do_write_sync(buffers_);
+                static const std::string expect_100_continue = "HTTP/1.1 100 Continue\r\n\r\n";
+                is_writing_ = true;
+                auto self = this->shared_from_this();
+                asio::async_write(
+                  adaptor_.socket(), asio::buffer(expect_100_continue),
+                  [self](const error_code& ec, std::size_t /*bytes_transferred*/) {
+                      self->is_writing_ = false;
+                      if (ec)
+                          self->finish_write(ec);
+                      else if (self->write_deferred_)
+                          self->start_write();
+                      else if (self->need_to_start_read_after_complete_)
+                          self->resume_read();
+                  });
             }
         }
 
+        /// Whether the current response has not been completed by its handler or is still being
+        /// written. The parser holds back pipelined requests until it is done.
+        bool response_pending() const
+        {
+            return need_to_call_after_handlers_ || is_writing_;
+        }
+
         void handle()
         {
             // TODO(EDev): cancel_deadline_timer should be looked into, it might be a good idea to add it to handle_url() and then restart the timer once everything passes
@@ -145,7 +161,7 @@ namespace crow
             req_.middleware_container = static_cast<void*>(middlewares_);
             req_.io_context = &adaptor_.get_io_context();
 
-            req_.remote_ip_address = adaptor_.remote_endpoint().address().to_string();
+            req_.remote_ip_address = adaptor_.address();
 
             add_keep_alive_ = req_.keep_alive;
             close_connection_ = req_.close_connection;
@@ -216,6 +232,9 @@ namespace crow
         /// Call the after handle middleware and send the write the response to the connection.
         void complete_request()
         {
+            // Responses completed outside of the read handler (e.g. from another thread) hold the
+            // last reference to this connection in the completion handler, which is reset below.
+            auto self = this->shared_from_this();
             CROW_LOG_INFO << "Response: " << this << ' ' << req_.raw_url << ' ' << res.code << ' ' << close_connection_;
             res.is_alive_helper_ = nullptr;
 
@@ -231,47 +250,103 @@ namespace crow
                   decltype(*middlewares_)>({}, *middlewares_, ctx_, req_, res);
             }
 #ifdef CROW_ENABLE_COMPRESSION
-            if (!res.body.empty() && handler_->compression_used())
+            if (res.compressed && handler_->compression_used() && res.body_size() > 0 &&
+                res.body_size() >= handler_->compression_min_size() && res.get_header_value("Content-Encoding").empty())
             {
-                std::string accept_encoding = req_.get_header_value("Accept-Encoding");
-                if (!accept_encoding.empty() && res.compressed)
+                const std::string vary = res.get_header_value("Vary");
+                res.set_header("Vary", vary.empty() ? "Accept-Encoding" : vary + ", Accept-Encoding");
+
+                compression::algorithm algorithm;
+                if (compression::negotiate(req_.get_header_value("Accept-Encoding"), handler_->compression_algorithm(), algorithm))
                 {
-                    switch (handler_->compression_algorithm())
+                    const char* body_data = res.has_body_view() ? res.body_view_.data : res.body.data();
+                    std::string compressed = compression::compress_string(body_data, res.body_size(), algorithm, handler_->compression_level());
+                    if (!compressed.empty())
                     {
-                        case compression::DEFLATE:
-                            if (accept_encoding.find("deflate") != std::string::npos)
-                            {
-                                res.body = compression::compress_string(res.body, compression::algorithm::DEFLATE);
-                                res.set_header("Content-Encoding", "deflate");
-                            }
-                            break;
-                        case compression::GZIP:
-                            if (accept_encoding.find("gzip") != std::string::npos)
-                            {
-                                res.body = compression::compress_string(res.body, compression::algorithm::GZIP);
-                                res.set_header("Content-Encoding", "gzip");
-                            }
-                            break;
-                        default:
-                            break;
+                        res.body = std::move(compressed);
+                        res.body_view_ = response::body_view{};
+                        res.set_header("Content-Encoding", algorithm == compression::GZIP ? "gzip" : "deflate");
+                        // The encoded body is a different representation: a strong validator has to be weakened.
+                        const std::string etag = res.get_header_value("ETag");
+                        if (!etag.empty() && etag.compare(0, 2, "W/") != 0)
+                            res.set_header("ETag", "W/" + etag);
                     }
                 }
             }
 #endif
 
+            apply_range();
             prepare_buffers();
 
-            if (res.is_static_type())
+            if (is_writing_)
             {
-                do_write_static();
+                // "100 Continue" is still being sent, the response follows it.
+                write_deferred_ = true;
+                return;
+            }
+            start_write();
+        }
+
+    private:
+        /// Answer a `Range` request for a response that accepts ranges with 206 (Partial Content)
+        /// or 416 (Range Not Satisfiable). An `If-Range` validator that does not strongly match
+        /// the response's `ETag` or `Last-Modified` header sends the whole response instead.
+        void apply_range()
+        {
+            if (!res.accept_ranges || res.code != status::OK)
+                return;
+            res.set_header("Accept-Ranges", "bytes");
+            const std::string& range = req_.get_header_value("Range");
+            if (req_.method != HTTPMethod::Get || range.empty())
+                return;
+            const std::string& if_range = req_.get_header_value("If-Range");
+            if (!if_range.empty())
+            {
+                const bool is_etag = if_range.front() == '"' || if_range.compare(0, 2, "W/") == 0;
+                const std::string validator = res.get_header_value(is_etag ? "ETag" : "Last-Modified");
+                if (validator != if_range || validator.compare(0, 2, "W/") == 0)
+                    return;
+            }
+
+            const bool is_static = res.is_static_type();
+            const std::size_t size = is_static ? static_cast<std::size_t>(res.file_info.statbuf.st_size) : res.body_size();
+            std::size_t first = 0, last = 0;
+            switch (utility::parse_byte_range(range, size, first, last))
+            {
+                case utility::byte_range::none:
+                    return;
+                case utility::byte_range::unsatisfiable:
+                    res.code = status::RANGE_NOT_SATISFIABLE;
+                    res.set_header("Content-Range", "bytes */" + std::to_string(size));
+                    res.headers.erase("Content-Length");
+                    res.file_info = response::static_file_info{};
+                    res.body.clear();
+                    res.body_view_ = response::body_view{};
+                    return;
+                case utility::byte_range::satisfiable:
+                    break;
+            }
+
+            const std::size_t length = last - first + 1;
+            res.code = status::PARTIAL_CONTENT;
+            res.set_header("Content-Range", "bytes " + std::to_string(first) + '-' + std::to_string(last) + '/' + std::to_string(size));
+            if (is_static)
+            {
+                static_offset_ = first;
+                static_remaining_ = length;
+                res.set_header("Content-Length", std::to_string(length));
+            }
+            else if (res.has_body_view())
+            {
+                res.body_view_.data += first;
+                res.body_view_.size = length;
             }
             else
             {
-                do_write_general();
+                res.body = res.body.substr(first, length);
             }
         }
 
-    private:
         void prepare_buffers()
         {
             res.complete_request_handler_ = nullptr;
@@ -346,7 +421,7 @@ namespace crow
             auto& status = statusCodes.find(res.code)->second;
             buffers_.emplace_back(status.data(), status.size());
 
-            if (res.code >= 400 && res.body.empty())
+            if (res.code >= 400 && res.body_size() == 0)
                 res.body = statusCodes[res.code].substr(9);
 
             for (auto& kv : res.headers)
@@ -359,7 +434,7 @@ namespace crow
 
             if (!res.manual_length_header && !res.headers.count("content-length"))
             {
-                content_length_ = std::to_string(res.body.size());
+                content_length_ = std::to_string(res.body_size());
                 static std::string content_length_tag = "Content-Length: ";
                 buffers_.emplace_back(content_length_tag.data(), content_length_tag.size());
                 buffers_.emplace_back(content_length_.data(), content_length_.size());
@@ -390,80 +465,155 @@ namespace crow
             buffers_.emplace_back(crlf.data(), crlf.size());
         }
 
+        /// Write the headers, then the file one chunk at a time. Every chunk is read when the
+        /// previous one has been sent, so a slow client never blocks the IO thread and only one
+        /// chunk per connection is held in memory. Reading the next request waits until the
+        /// whole file has been written.
         void do_write_static()
         {
-            asio::write(adaptor_.socket(), buffers_);
-
-            if (res.file_info.statResult == 0)
+            if (res.code != status::PARTIAL_CONTENT)
             {
-                std::ifstream is(res.file_info.path.c_str(), std::ios::in | std::ios::binary);
-                std::vector<asio::const_buffer> buffers{1};
-                char buf[16384];
-                is.read(buf, sizeof(buf));
-                while (is.gcount() > 0)
-                {
-                    buffers[0] = asio::buffer(buf, is.gcount());
-                    do_write_sync(buffers);
-                    is.read(buf, sizeof(buf));
-                }
+                static_offset_ = 0;
+                static_remaining_ = static_cast<std::size_t>(res.file_info.statbuf.st_size);
             }
-            if (close_connection_)
+            if (res.file_info.statResult == 0)
             {
-                adaptor_.shutdown_readwrite();
-                adaptor_.close();
-                CROW_LOG_DEBUG << this << " from write (static)";
+                static_file_.reset(new std::ifstream(res.file_info.path.c_str(), std::ios::in | std::ios::binary));
+                static_file_->seekg(static_cast<std::streamoff>(static_offset_));
             }
+            is_writing_ = true;
+            cancel_deadline_timer();
 
-            res.end();
-            res.clear();
-            buffers_.clear();
-            parser_.clear();
+            auto self = this->shared_from_this();
+            asio::async_write(
+              adaptor_.socket(), buffers_,
+              [self](const error_code& ec, std::size_t /*bytes_transferred*/) {
+                  self->res.end();
+                  self->res.clear();
+                  self->buffers_.clear();
+                  if (ec)
+                      self->finish_write(ec);
+                  else
+                      self->do_write_static_chunk();
+              });
+        }
+
+        void do_write_static_chunk()
+        {
+            if (static_file_ && *static_file_ && static_remaining_ > 0)
+            {
+                static_buffer_.resize(std::min<std::size_t>(65536, static_remaining_));
+                static_file_->read(static_buffer_.data(), static_buffer_.size());
+                const auto count = static_cast<std::size_t>(static_file_->gcount());
+                static_remaining_ -= count;
+                if (count > 0)
+                {
+                    auto self = this->shared_from_this();
+                    asio::async_write(
+                      adaptor_.socket(), asio::buffer(static_buffer_.data(), count),
+                      [self](const error_code& ec, std::size_t /*bytes_transferred*/) {
+                          if (ec)
+                              self->finish_write(ec);
+                          else
+                              self->do_write_static_chunk();
+                      });
+                    return;
+                }
+            }
+            finish_write(error_code());
         }
 
+        /// Write the response headers and body with a single gathering write. The buffers stay
+        /// valid until the completion handler runs: headers are owned by res, the body by
+        /// res_body_copy_ or res_body_owner_.
         void do_write_general()
         {
-            if (res.body.length() < res_stream_threshold_)
+            if (res.has_body_view())
+            {
+                // The body buffer is owned elsewhere: write it without copying.
+                res_body_owner_ = std::move(res.body_view_.owner);
+                buffers_.emplace_back(res.body_view_.data, res.body_view_.size);
+            }
+            else if (!res.body.empty())
             {
                 res_body_copy_.swap(res.body);
                 buffers_.emplace_back(res_body_copy_.data(), res_body_copy_.size());
+            }
+            is_writing_ = true;
+            cancel_deadline_timer();
 
-                do_write_sync(buffers_);
+            auto self = this->shared_from_this();
+            asio::async_write(
+              adaptor_.socket(), buffers_,
+              [self](const error_code& ec, std::size_t /*bytes_transferred*/) {
+                  self->finish_write(ec);
+              });
+        }
 
-                if (need_to_start_read_after_complete_)
-                {
-                    need_to_start_read_after_complete_ = false;
-                    start_deadline();
-                    do_read();
-                }
+        void start_write()
+        {
+            write_deferred_ = false;
+            if (res.is_static_type())
+            {
+                do_write_static();
             }
             else
             {
-                asio::write(adaptor_.socket(), buffers_); // Write the response start / headers
-                cancel_deadline_timer();
-                if (res.body.length() > 0)
-                {
-                    std::vector<asio::const_buffer> buffers{1};
-                    const uint8_t* data = reinterpret_cast<const uint8_t*>(res.body.data());
-                    size_t length = res.body.length();
-                    for (size_t transferred = 0; transferred < length;)
-                    {
-                        size_t to_transfer = CROW_MIN(16384UL, length - transferred);
-                        buffers[0] = asio::const_buffer(data + transferred, to_transfer);
-                        do_write_sync(buffers);
-                        transferred += to_transfer;
-                    }
-                }
-                if (close_connection_)
-                {
-                    adaptor_.shutdown_readwrite();
-                    adaptor_.close();
-                    CROW_LOG_DEBUG << this << " from write (res_stream)";
-                }
+                do_write_general();
+            }
+        }
+
+        void finish_write(const error_code& ec)
+        {
+            static_file_.reset();
+            std::vector<char>().swap(static_buffer_);
+            res.clear();
+            res_body_copy_.clear();
+            res_body_owner_.reset();
+            buffers_.clear();
+            is_writing_ = false;
+            write_deferred_ = false;
+            parser_.clear();
+
+            if (ec || close_connection_)
+            {
+                if (ec)
+                    CROW_LOG_DEBUG << this << " error while writing: " << ec.message();
+                adaptor_.shutdown_readwrite();
+                adaptor_.close();
+                CROW_LOG_DEBUG << this << " from write";
+                return;
+            }
+            if (need_to_start_read_after_complete_)
+                resume_read();
+        }
 
-                res.end();
-                res.clear();
-                buffers_.clear();
-                parser_.clear();
+        /// Continue after an asynchronously written response: first with pipelined requests that
+        /// arrived before it was done, then by reading from the socket.
+        void resume_read()
+        {
+            need_to_start_read_after_complete_ = false;
+            start_deadline();
+            if (!parser_.resume())
+            {
+                cancel_deadline_timer();
+                parser_.done();
+                adaptor_.shutdown_read();
+                adaptor_.close();
+                CROW_LOG_DEBUG << this << " from resume";
+            }
+            else if (close_connection_)
+            {
+                cancel_deadline_timer();
+                parser_.done();
+            }
+            else if (!response_pending())
+            {
+                do_read();
+            }
+            else
+            {
+                need_to_start_read_after_complete_ = true;
             }
         }
 
@@ -497,75 +647,19 @@ namespace crow
                       self->parser_.done();
                       // adaptor will close after write
                   }
-                  else if (!self->need_to_call_after_handlers_)
+                  else if (!self->response_pending())
                   {
                       self->start_deadline();
                       self->do_read();
                   }
                   else
                   {
-                      // res will be completed later by user
+                      // res will be completed later by user, or is still being written
                       self->need_to_start_read_after_complete_ = true;
                   }
               });
         }
 
-        void do_write()
-        {
-            auto self = this->shared_from_this();
-            asio::async_write(
-              adaptor_.socket(), buffers_,
-              [self](const error_code& ec, std::size_t /*bytes_transferred*/) {
-                  self->res.clear();
-                  self->res_body_copy_.clear();
-                  if (!self->continue_requested)
-                  {
-                      self->parser_.clear();
-                  }
-                  else
-                  {
-                      self->continue_requested = false;
-                  }
-
-                  if (!ec)
-                  {
-                      if (self->close_connection_)
-                      {
-                          self->adaptor_.shutdown_write();
-                          self->adaptor_.close();
-                          CROW_LOG_DEBUG << self << " from write(1)";
-                      }
-                  }
-                  else
-                  {
-                      CROW_LOG_DEBUG << self << " from write(2)";
-                  }
-              });
-        }
-
-        inline void do_write_sync(std::vector<asio::const_buffer>& buffers)
-        {
-            error_code ec;
-            asio::write(adaptor_.socket(), buffers, ec);
-
-            this->res.clear();
-            this->res_body_copy_.clear();
-            if (this->continue_requested)
-            {
-                this->continue_requested = false;
-            }
-            else
-            {
-                this->parser_.clear();
-            }
-
-            if (ec)
-            {
-                CROW_LOG_ERROR << ec << " - happened while sending buffers";
-                CROW_LOG_DEBUG << this << " from write (sync)(2)";
-            }
-        }
-
         void cancel_deadline_timer()
         {
             CROW_LOG_DEBUG << this << " timer cancelled: " << &task_timer_ << ' ' << task_id_;
@@ -607,13 +701,20 @@ namespace crow
         std::string content_length_;
         std::string date_str_;
         std::string res_body_copy_;
+        std::shared_ptr<const void> res_body_owner_;
+
+        std::unique_ptr<std::ifstream> static_file_;
+        std::vector<char> static_buffer_;
+        std::size_t static_offset_{};
+        std::size_t static_remaining_{};
 
         detail::task_timer::identifier_type task_id_{};
 
-        bool continue_requested{};
         bool need_to_call_after_handlers_{};
         bool need_to_start_read_after_complete_{};
         bool add_keep_alive_{};
+        bool is_writing_{};
+        bool write_deferred_{};
 
         std::tuple<Middlewares...>* middlewares_;
         detail::context<Middlewares...> ctx_;
@@ -621,8 +722,6 @@ namespace crow
         std::function<std::string()>& get_cached_date_str;
         detail::task_timer& task_timer_;
 
-        size_t res_stream_threshold_;
-
         std::atomic<unsigned int>& queue_length_;
     };
 
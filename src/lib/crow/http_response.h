@@ -1,4 +1,5 @@
 #pragma once
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <ios>
@@ -44,6 +45,7 @@ namespace crow
 #ifdef CROW_ENABLE_COMPRESSION
         bool compressed = true; ///< If compression is enabled and this is false, the individual response will not be compressed.
 #endif
+        bool accept_ranges = false;        ///< Whether a GET request may ask for a byte range of the body (set for static files).
         bool skip_body = false;            ///< Whether this is a response to a HEAD request.
         bool manual_length_header = false; ///< Whether Crow should automatically add a "Content-Length" header.
 
@@ -166,10 +168,15 @@ namespace crow
         response& operator=(response&& r) noexcept
         {
             body = std::move(r.body);
+            body_view_ = std::move(r.body_view_);
             code = r.code;
             headers = std::move(r.headers);
             completed_ = r.completed_;
             file_info = std::move(r.file_info);
+            accept_ranges = r.accept_ranges;
+#ifdef CROW_ENABLE_COMPRESSION
+            compressed = r.compressed;
+#endif
             return *this;
         }
 
@@ -182,10 +189,15 @@ namespace crow
         void clear()
         {
             body.clear();
+            body_view_ = body_view{};
             code = 200;
             headers.clear();
             completed_ = false;
             file_info = static_file_info{};
+            accept_ranges = false;
+#ifdef CROW_ENABLE_COMPRESSION
+            compressed = true;
+#endif
         }
 
         /// Return a "Temporary Redirect" response.
@@ -241,8 +253,9 @@ namespace crow
                 completed_ = true;
                 if (skip_body)
                 {
-                    set_header("Content-Length", std::to_string(body.size()));
+                    set_header("Content-Length", std::to_string(body_size()));
                     body = "";
+                    body_view_ = body_view{};
                     manual_length_header = true;
                 }
                 if (complete_request_handler_)
@@ -261,6 +274,29 @@ namespace crow
             end();
         }
 
+        /// Use an externally owned buffer as the response body instead of `body`.
+
+        ///
+        /// The buffer is written to the socket without being copied.
+        /// `owner` is kept alive until the response has been sent.
+        void set_body_view(std::shared_ptr<const void> owner, const char* data, std::size_t size)
+        {
+            body.clear();
+            body_view_ = body_view{std::move(owner), data, size};
+        }
+
+        /// Check whether the body is an external buffer set with \ref set_body_view().
+        bool has_body_view() const noexcept
+        {
+            return body_view_.owner != nullptr;
+        }
+
+        /// Size of the response body in bytes, regardless of how it is stored.
+        std::size_t body_size() const noexcept
+        {
+            return has_body_view() ? body_view_.size : body.size();
+        }
+
         /// Check if the connection is still alive (usually by checking the socket status).
         bool is_alive()
         {
@@ -304,6 +340,7 @@ namespace crow
                 std::size_t last_dot = path.find_last_of('.');
                 std::string extension = path.substr(last_dot + 1);
                 code = 200;
+                accept_ranges = true;
                 this->add_header("Content-Length", std::to_string(file_info.statbuf.st_size));
 
                 if (!extension.empty())
@@ -319,9 +356,17 @@ namespace crow
         }
 
     private:
+        struct body_view
+        {
+            std::shared_ptr<const void> owner;
+            const char* data = nullptr;
+            std::size_t size = 0;
+        };
+
         bool completed_{};
         std::function<void()> complete_request_handler_;
         std::function<bool()> is_alive_helper_;
         static_file_info file_info;
+        body_view body_view_;
     };
 } // namespace crow
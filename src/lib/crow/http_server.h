@@ -20,6 +20,7 @@
 #include <cstdint>
 #include <future>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "crow/version.h"
@@ -38,12 +39,69 @@ namespace crow // NOTE: Already documented in "crow/app.h"
 #endif
     using tcp = asio::ip::tcp;
 
-    template<typename Handler, typename Adaptor = SocketAdaptor, typename... Middlewares>
+    /// Listens on a TCP endpoint.
+    struct TCPAcceptor
+    {
+        using endpoint = tcp::endpoint;
+
+        TCPAcceptor(asio::io_context& io_context, const endpoint& endpoint):
+          acceptor_(io_context, endpoint)
+        {}
+
+        tcp::acceptor& raw_acceptor()
+        {
+            return acceptor_;
+        }
+
+        uint16_t port() const
+        {
+            return acceptor_.local_endpoint().port();
+        }
+
+        std::string url_display(bool ssl_used) const
+        {
+            return (ssl_used ? "https://" : "http://") + acceptor_.local_endpoint().address().to_string() + ":" + std::to_string(port());
+        }
+
+        tcp::acceptor acceptor_;
+    };
+
+#ifdef CROW_HAS_UNIX_SOCKET
+    /// Listens on a Unix domain socket. The socket file is created when the acceptor is
+    /// constructed and has to be removed by the owner.
+    struct UnixSocketAcceptor
+    {
+        using endpoint = stream_protocol::endpoint;
+
+        UnixSocketAcceptor(asio::io_context& io_context, const endpoint& endpoint):
+          acceptor_(io_context, endpoint, false)
+        {}
+
+        stream_protocol::acceptor& raw_acceptor()
+        {
+            return acceptor_;
+        }
+
+        uint16_t port() const
+        {
+            return 0;
+        }
+
+        std::string url_display(bool) const
+        {
+            return "unix://" + acceptor_.local_endpoint().path();
+        }
+
+        stream_protocol::acceptor acceptor_;
+    };
+#endif
+
+    template<typename Handler, typename Acceptor = TCPAcceptor, typename Adaptor = SocketAdaptor, typename... Middlewares>
     class Server
     {
     public:
       Server(Handler* handler,
-             const tcp::endpoint& endpoint,
+             const typename Acceptor::endpoint& endpoint,
              std::string server_name = std::string("Crow/") + VERSION,
              std::tuple<Middlewares...>* middlewares = nullptr,
              uint16_t concurrency = 1,
@@ -154,12 +212,12 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                   });
             }
 
-            handler_->port(acceptor_.local_endpoint().port());
+            handler_->port(acceptor_.port());
 
 
             CROW_LOG_INFO << server_name_
-                          << " server is running at " << (handler_->ssl_used() ? "https://" : "http://")
-                          << acceptor_.local_endpoint().address() << ":" << acceptor_.local_endpoint().port() << " using " << concurrency_ << " threads";
+                          << " server is running at " << acceptor_.url_display(handler_->ssl_used())
+                          << " using " << concurrency_ << " threads";
             CROW_LOG_INFO << "Call `app.loglevel(crow::LogLevel::Warning)` to hide Info level logs.";
 
             signals_.async_wait(
@@ -198,7 +256,7 @@ namespace crow // NOTE: Already documented in "crow/app.h"
         }
 
         uint16_t port() const {
-            return acceptor_.local_endpoint().port();
+            return acceptor_.port();
         }
 
         /// Wait until the server has properly started or until timeout
@@ -252,7 +310,7 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                   ic, handler_, server_name_, middlewares_,
                   get_cached_date_str_pool_[context_idx], *task_timer_pool_[context_idx], adaptor_ctx_, task_queue_length_pool_[context_idx]);
 
-                acceptor_.async_accept(
+                acceptor_.raw_acceptor().async_accept(
                   p->socket(),
                   [this, p, &ic, context_idx](error_code ec) {
                       if (!ec)
@@ -285,7 +343,7 @@ namespace crow // NOTE: Already documented in "crow/app.h"
         asio::io_context io_context_;
         std::vector<detail::task_timer*> task_timer_pool_;
         std::vector<std::function<std::string()>> get_cached_date_str_pool_;
-        tcp::acceptor acceptor_;
+        Acceptor acceptor_;
         bool shutting_down_ = false;
         bool server_started_{false};
         std::condition_variable cv_started_;
@@ -97,6 +97,13 @@ namespace crow
 
             self->message_complete = true;
             self->process_message();
+            // Stop before pipelined requests while the response is still pending.
+            // feed() keeps the rest of the buffer for resume().
+            if (self->handler_->response_pending())
+            {
+                self->paused_ = true;
+                return 1;
+            }
             return 0;
         }
         HTTPParser(Handler* handler):
@@ -125,6 +132,13 @@ namespace crow
             };
 
             int nparsed = http_parser_execute(this, &settings_, buffer, length);
+            if (paused_)
+            {
+                paused_ = false;
+                http_errno = CHPE_OK;
+                pending_.append(buffer + nparsed, length - nparsed);
+                return true;
+            }
             if (http_errno != CHPE_OK)
             {
                 return false;
@@ -137,6 +151,14 @@ namespace crow
             return feed(nullptr, 0);
         }
 
+        /// Parse the pipelined requests held back while a response was written.
+        bool resume()
+        {
+            std::string pending;
+            pending.swap(pending_);
+            return pending.empty() || feed(pending.data(), static_cast<int>(pending.size()));
+        }
+
         void clear()
         {
             req = crow::request();
@@ -190,6 +212,8 @@ namespace crow
     private:
         int header_building_state = 0;
         bool message_complete = false;
+        bool paused_ = false;
+        std::string pending_;
         std::string header_field;
         std::string header_value;
 
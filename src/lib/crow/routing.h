@@ -128,6 +128,13 @@ namespace crow // NOTE: Already documented in "crow/app.h"
             res.end();
         }
 #endif
+#ifdef CROW_HAS_UNIX_SOCKET
+        virtual void handle_upgrade(const request&, response& res, UnixSocketAdaptor&&)
+        {
+            res = response(404);
+            res.end();
+        }
+#endif
 
         uint32_t get_methods()
         {
@@ -448,6 +455,13 @@ namespace crow // NOTE: Already documented in "crow/app.h"
             new crow::websocket::Connection<SSLAdaptor, App>(req, std::move(adaptor), app_, max_payload_, subprotocols_, open_handler_, message_handler_, close_handler_, error_handler_, accept_handler_, mirror_protocols_);
         }
 #endif
+#ifdef CROW_HAS_UNIX_SOCKET
+        void handle_upgrade(const request& req, response&, UnixSocketAdaptor&& adaptor) override
+        {
+            max_payload_ = max_payload_override_ ? max_payload_ : app_->websocket_max_payload();
+            new crow::websocket::Connection<UnixSocketAdaptor, App>(req, std::move(adaptor), app_, max_payload_, subprotocols_, open_handler_, message_handler_, close_handler_, error_handler_, accept_handler_, mirror_protocols_);
+        }
+#endif
 
         /// Override the global payload limit for this single WebSocket rule
         self_t& max_payload(uint64_t max_payload)
@@ -33,6 +33,11 @@ namespace crow
     using error_code = asio::error_code;
 #endif
     using tcp = asio::ip::tcp;
+// Windows asio has local sockets too, but the server needs POSIX stat()/unlink().
+#if (defined(ASIO_HAS_LOCAL_SOCKETS) || defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)) && !defined(_WIN32)
+#define CROW_HAS_UNIX_SOCKET
+    using stream_protocol = asio::local::stream_protocol;
+#endif
 
     /// A wrapper for the asio::ip::tcp::socket and asio::ssl::stream
     struct SocketAdaptor
@@ -64,6 +69,12 @@ namespace crow
             return socket_.remote_endpoint();
         }
 
+        /// Address of the peer, used as request::remote_ip_address.
+        std::string address()
+        {
+            return socket_.remote_endpoint().address().to_string();
+        }
+
         bool is_open()
         {
             return socket_.is_open();
@@ -127,6 +138,11 @@ namespace crow
             return raw_socket().remote_endpoint();
         }
 
+        std::string address()
+        {
+            return raw_socket().remote_endpoint().address().to_string();
+        }
+
         bool is_open()
         {
             return ssl_socket_ ? raw_socket().is_open() : false;
@@ -185,4 +201,79 @@ namespace crow
         std::unique_ptr<asio::ssl::stream<tcp::socket>> ssl_socket_;
     };
 #endif
+
+#ifdef CROW_HAS_UNIX_SOCKET
+    /// A wrapper for a Unix domain socket (asio::local::stream_protocol::socket).
+    struct UnixSocketAdaptor
+    {
+        using context = void;
+        UnixSocketAdaptor(asio::io_context& io_context, context*):
+          socket_(io_context)
+        {}
+
+        asio::io_context& get_io_context()
+        {
+            return GET_IO_CONTEXT(socket_);
+        }
+
+        stream_protocol::socket& raw_socket()
+        {
+            return socket_;
+        }
+
+        stream_protocol::socket& socket()
+        {
+            return socket_;
+        }
+
+        stream_protocol::endpoint remote_endpoint()
+        {
+            return socket_.remote_endpoint();
+        }
+
+        /// Peers of a Unix domain socket have no network address: the socket path is used instead.
+        std::string address()
+        {
+            error_code ec;
+            return socket_.local_endpoint(ec).path();
+        }
+
+        bool is_open()
+        {
+            return socket_.is_open();
+        }
+
+        void close()
+        {
+            error_code ec;
+            socket_.close(ec);
+        }
+
+        void shutdown_readwrite()
+        {
+            error_code ec;
+            socket_.shutdown(asio::socket_base::shutdown_type::shutdown_both, ec);
+        }
+
+        void shutdown_write()
+        {
+            error_code ec;
+            socket_.shutdown(asio::socket_base::shutdown_type::shutdown_send, ec);
+        }
+
+        void shutdown_read()
+        {
+            error_code ec;
+            socket_.shutdown(asio::socket_base::shutdown_type::shutdown_receive, ec);
+        }
+
+        template<typename F>
+        void start(F f)
+        {
+            f(error_code());
+        }
+
+        stream_protocol::socket socket_;
+    };
+#endif
 } // namespace crow
@@ -928,5 +928,57 @@ namespace crow
             }
             return last1;
         }
+
+        /// Result of \ref parse_byte_range().
+        enum class byte_range
+        {
+            none,         ///< No usable single byte range: send the whole representation.
+            satisfiable,  ///< `first` and `last` (inclusive) are set.
+            unsatisfiable ///< The range lies outside the representation (416).
+        };
+
+        /**
+         * @brief Parse a `Range` header for a representation of `size` bytes.
+         *
+         * Only a single range (`bytes=a-b`, `bytes=a-` or `bytes=-n`) is supported. Multiple
+         * ranges and malformed headers yield `none`, which lets the server ignore the header.
+         */
+        inline static byte_range parse_byte_range(const std::string& header, std::size_t size, std::size_t& first, std::size_t& last)
+        {
+            static const std::string unit = "bytes=";
+            if (header.compare(0, unit.size(), unit) != 0)
+                return byte_range::none;
+            const std::string spec = trim(header.substr(unit.size()));
+            const auto dash = spec.find('-');
+            if (dash == std::string::npos || spec.find(',') != std::string::npos)
+                return byte_range::none;
+
+            const auto parse = [](const std::string& s, std::size_t& value) {
+                if (s.empty() || s.size() > 18 || s.find_first_not_of("0123456789") != std::string::npos)
+                    return false;
+                value = std::stoull(s);
+                return true;
+            };
+            const std::string from = trim(spec.substr(0, dash)), to = trim(spec.substr(dash + 1));
+            std::size_t a = 0, b = 0;
+            if (from.empty())
+            {
+                // Suffix range: the last `b` bytes.
+                if (!parse(to, b))
+                    return byte_range::none;
+                if (b == 0 || size == 0)
+                    return byte_range::unsatisfiable;
+                first = size - std::min(b, size);
+                last = size - 1;
+                return byte_range::satisfiable;
+            }
+            if (!parse(from, a) || (!to.empty() && (!parse(to, b) || b < a)))
+                return byte_range::none;
+            if (a >= size)
+                return byte_range::unsatisfiable;
+            first = a;
+            last = to.empty() ? size - 1 : std::min(b, size - 1);
+            return byte_range::satisfiable;
+        }
     } // namespace utility
 } // namespace crow
@@ -1,5 +1,7 @@
 #pragma once
 #include <array>
+#include <atomic>
+#include <chrono>
 #include "crow/logging.h"
 #include "crow/socket_adaptors.h"
 #include "crow/http_request.h"
@@ -57,11 +59,48 @@ namespace crow // NOTE: Already documented in "crow/app.h"
             EndStatusCodes = 4999,
         };
 
+        /// Generate the websocket headers using an opcode and the message size (in bytes).
+        inline std::string build_header(int opcode, size_t size)
+        {
+            char buf[2 + 8] = "\x80\x00";
+            buf[0] += opcode;
+            if (size < 126)
+            {
+                buf[1] += static_cast<char>(size);
+                return {buf, buf + 2};
+            }
+            else if (size < 0x10000)
+            {
+                buf[1] += 126;
+                *(uint16_t*)(buf + 2) = htons(static_cast<uint16_t>(size));
+                return {buf, buf + 4};
+            }
+            else
+            {
+                buf[1] += 127;
+                *reinterpret_cast<uint64_t*>(buf + 2) = ((1 == htonl(1)) ? static_cast<uint64_t>(size) : (static_cast<uint64_t>(htonl((size)&0xFFFFFFFF)) << 32) | htonl(static_cast<uint64_t>(size) >> 32));
+                return {buf, buf + 10};
+            }
+        }
+
+        /// Build a complete, immutable frame (header and payload) that can be
+        /// sent to any number of connections with \ref connection::send_frame.
+        inline std::shared_ptr<const std::string> make_frame(int opcode, const std::string& payload)
+        {
+            auto frame = std::make_shared<std::string>(build_header(opcode, payload.size()));
+            frame->append(payload);
+            return frame;
+        }
+
         /// A base class for websocket connection.
         struct connection
         {
             virtual void send_binary(std::string msg) = 0;
             virtual void send_text(std::string msg) = 0;
+            virtual void send_frame(std::shared_ptr<const std::string> frame) = 0;
+            virtual void send_latest(std::shared_ptr<const std::string> frame, int slot) = 0;
+            virtual void set_max_queued_bytes(uint64_t bytes, std::chrono::milliseconds grace = std::chrono::milliseconds(0)) = 0;
+            virtual uint64_t queued_bytes() const = 0;
             virtual void send_ping(std::string msg) = 0;
             virtual void send_pong(std::string msg) = 0;
             virtual void close(std::string const& msg = "quit", uint16_t status_code = CloseStatusCode::NormalClosure) = 0;
@@ -99,6 +138,24 @@ namespace crow // NOTE: Already documented in "crow/app.h"
         // +---------------------------------------------------------------+
         //
 
+        namespace detail
+        {
+            /// A queued write: either an owned string or a shared, pre-built frame.
+            struct write_buffer
+            {
+                write_buffer(std::string data):
+                  owned(std::move(data)) {}
+                write_buffer(std::shared_ptr<const std::string> frame):
+                  shared(std::move(frame)) {}
+
+                const std::string& get() const { return shared ? *shared : owned; }
+
+                std::string owned;
+                std::shared_ptr<const std::string> shared;
+                int slot{0};
+            };
+        } // namespace detail
+
         /// A websocket connection.
 
         template<typename Adaptor, typename Handler>
@@ -252,6 +309,56 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                 send_data(0x1, std::move(msg));
             }
 
+            /// Send a frame built by \ref make_frame.
+
+            ///
+            /// The frame is shared, not copied, so the same frame can be queued
+            /// on many connections.
+            void send_frame(std::shared_ptr<const std::string> frame) override
+            {
+                post([this, frame = std::move(frame)]() mutable {
+                    enqueue(detail::write_buffer(std::move(frame)));
+                    write_queued();
+                });
+            }
+
+            /// Send a frame that supersedes earlier ones sent to the same slot.
+
+            ///
+            /// If a frame queued by send_latest() with the same (nonzero) slot
+            /// has not started sending yet, it is replaced instead of queueing
+            /// another one. Use this for messages where only the newest one matters.
+            void send_latest(std::shared_ptr<const std::string> frame, int slot) override
+            {
+                post([this, frame = std::move(frame), slot]() mutable {
+                    detail::write_buffer buffer(std::move(frame));
+                    buffer.slot = slot;
+                    enqueue(std::move(buffer));
+                    write_queued();
+                });
+            }
+
+            /// Limit the bytes waiting to be sent (0 means unlimited).
+
+            ///
+            /// Only queued messages count: not those being written to the socket
+            /// and not send_latest() frames, which are replaced instead of piling
+            /// up. A connection that stays over the limit for longer than `grace`
+            /// is closed with CloseStatusCode::PolicyViolated when the next
+            /// message is sent. Must be called on the connection's thread,
+            /// e.g. from the open handler.
+            void set_max_queued_bytes(uint64_t bytes, std::chrono::milliseconds grace = std::chrono::milliseconds(0)) override
+            {
+                max_queued_bytes_ = bytes;
+                queue_grace_ = grace;
+            }
+
+            /// Bytes of sent messages that have not been written to the socket yet.
+            uint64_t queued_bytes() const override
+            {
+                return queued_bytes_.load(std::memory_order_relaxed);
+            }
+
             /// Send a close signal.
 
             ///
@@ -279,7 +386,7 @@ namespace crow // NOTE: Already documented in "crow/app.h"
 
             std::string get_remote_ip() override
             {
-                return adaptor_.remote_endpoint().address().to_string();
+                return adaptor_.address();
             }
 
             void set_max_payload_size(uint64_t payload)
@@ -294,30 +401,6 @@ namespace crow // NOTE: Already documented in "crow/app.h"
             }
 
         protected:
-            /// Generate the websocket headers using an opcode and the message size (in bytes).
-            std::string build_header(int opcode, size_t size)
-            {
-                char buf[2 + 8] = "\x80\x00";
-                buf[0] += opcode;
-                if (size < 126)
-                {
-                    buf[1] += static_cast<char>(size);
-                    return {buf, buf + 2};
-                }
-                else if (size < 0x10000)
-                {
-                    buf[1] += 126;
-                    *(uint16_t*)(buf + 2) = htons(static_cast<uint16_t>(size));
-                    return {buf, buf + 4};
-                }
-                else
-                {
-                    buf[1] += 127;
-                    *reinterpret_cast<uint64_t*>(buf + 2) = ((1 == htonl(1)) ? static_cast<uint64_t>(size) : (static_cast<uint64_t>(htonl((size)&0xFFFFFFFF)) << 32) | htonl(static_cast<uint64_t>(size) >> 32));
-                    return {buf, buf + 10};
-                }
-            }
-
             /// Send the HTTP upgrade response.
 
             ///
@@ -720,11 +803,14 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                 if (sending_buffers_.empty())
                 {
                     sending_buffers_.swap(write_buffers_);
+                    sending_bytes_ = write_bytes_;
+                    write_bytes_ = 0;
+                    slot_bytes_ = 0;
                     std::vector<asio::const_buffer> buffers;
                     buffers.reserve(sending_buffers_.size());
                     for (auto& s : sending_buffers_)
                     {
-                        buffers.emplace_back(asio::buffer(s));
+                        buffers.emplace_back(asio::buffer(s.get()));
                     }
                     auto watch = std::weak_ptr<void>{anchor_};
                     asio::async_write(
@@ -733,6 +819,8 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                           if (!ec && !close_connection_)
                           {
                               sending_buffers_.clear();
+                              sending_bytes_ = 0;
+                              update_queued_bytes();
                               if (!write_buffers_.empty())
                                   do_write();
                               if (has_sent_close_)
@@ -744,6 +832,8 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                               if (anchor == nullptr) { return; }
 
                               sending_buffers_.clear();
+                              sending_bytes_ = 0;
+                              update_queued_bytes();
                               close_connection_ = true;
                               check_destroy();
                           }
@@ -780,11 +870,80 @@ namespace crow // NOTE: Already documented in "crow/app.h"
             void send_data_impl(SendMessageType* s)
             {
                 auto header = build_header(s->opcode, s->payload.size());
-                write_buffers_.emplace_back(std::move(header));
-                write_buffers_.emplace_back(std::move(s->payload));
+                enqueue(detail::write_buffer(std::move(header)));
+                enqueue(detail::write_buffer(std::move(s->payload)));
+                write_queued();
+            }
+
+            /// Queue a message buffer, replacing a queued frame of the same slot if possible.
+            void enqueue(detail::write_buffer&& buffer)
+            {
+                const uint64_t size = buffer.get().size();
+                if (buffer.slot != 0)
+                {
+                    for (auto& queued : write_buffers_)
+                    {
+                        if (queued.slot == buffer.slot)
+                        {
+                            write_bytes_ -= queued.get().size();
+                            slot_bytes_ -= queued.get().size();
+                            queued = std::move(buffer);
+                            write_bytes_ += size;
+                            slot_bytes_ += size;
+                            update_queued_bytes();
+                            return;
+                        }
+                    }
+                }
+                write_bytes_ += size;
+                if (buffer.slot != 0)
+                    slot_bytes_ += size;
+                write_buffers_.emplace_back(std::move(buffer));
+                update_queued_bytes();
+            }
+
+            /// Start writing queued messages, or drop the connection if it stays over the limit.
+            void write_queued()
+            {
+                if (close_connection_)
+                    return;
+                if (over_limit() && std::chrono::steady_clock::now() - over_limit_since_ >= queue_grace_)
+                {
+                    // The peer is not reading; a close frame would be stuck behind the queue.
+                    write_buffers_.clear();
+                    write_bytes_ = 0;
+                    slot_bytes_ = 0;
+                    update_queued_bytes();
+                    close_connection_ = true;
+                    if (!is_close_handler_called_)
+                    {
+                        is_close_handler_called_ = true;
+                        if (close_handler_)
+                            close_handler_(*this, "send queue overflow", CloseStatusCode::PolicyViolated);
+                    }
+                    adaptor_.shutdown_readwrite();
+                    adaptor_.close();
+                    check_destroy(CloseStatusCode::PolicyViolated);
+                    return;
+                }
                 do_write();
             }
 
+            void update_queued_bytes()
+            {
+                queued_bytes_.store(write_bytes_ + sending_bytes_, std::memory_order_relaxed);
+                if (!over_limit())
+                    over_limit_since_ = {};
+                else if (over_limit_since_ == std::chrono::steady_clock::time_point{})
+                    over_limit_since_ = std::chrono::steady_clock::now();
+            }
+
+            /// Whether more bytes of queued messages are waiting than allowed.
+            bool over_limit() const
+            {
+                return max_queued_bytes_ && write_bytes_ - slot_bytes_ > max_queued_bytes_;
+            }
+
             void send_data(int opcode, std::string&& msg)
             {
                 SendMessageType event_arg{
@@ -799,8 +958,15 @@ namespace crow // NOTE: Already documented in "crow/app.h"
             Adaptor adaptor_;
             Handler* handler_;
 
-            std::vector<std::string> sending_buffers_;
-            std::vector<std::string> write_buffers_;
+            std::vector<detail::write_buffer> sending_buffers_;
+            std::vector<detail::write_buffer> write_buffers_;
+            uint64_t sending_bytes_{0};
+            uint64_t write_bytes_{0};
+            uint64_t slot_bytes_{0}; // Part of write_bytes_ in send_latest() frames.
+            uint64_t max_queued_bytes_{0};
+            std::chrono::milliseconds queue_grace_{0};
+            std::chrono::steady_clock::time_point over_limit_since_{};
+            std::atomic<uint64_t> queued_bytes_{0};
 
             std::array<char, 4096> buffer_;
             bool is_binary_;